@@ -0,0 +1,247 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright 2013 Jeet Sukumaran.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program. If not, see <http://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+// Measures the cost of logging and console output.
+//
+// Results are printed as tab-separated lines:
+//
+//      label   benchmark   threads   records   ns/record   records/s
+//
+// where the label (e.g., a commit hash) identifies the run, so that results
+// appended to a single file with "-o" can be compared across commits:
+//
+//      ./colugo-logger-bench --label $(git rev-parse --short HEAD) -o bench_output.txt
+//
+// Build:
+//
+//      c++ -std=c++17 -O2 -pthread -Iinclude -o colugo-logger-bench bench/logger_bench.cpp
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <vector>
+#include <colugo/cmdopt.hpp>
+#include <colugo/console.hpp>
+#include <colugo/logger.hpp>
+
+namespace {
+
+/**
+ * Sink that discards records, so that only formatting and dispatch are
+ * measured.
+ */
+class NullLogSink : public colugo::LogSink {
+    public:
+        void append(const char *, std::size_t) override {}
+};
+
+/**
+ * Stream buffer that discards everything, for console benchmarks.
+ */
+class NullStreamBuf : public std::streambuf {
+    protected:
+        int_type overflow(int_type c) override {
+            return traits_type::not_eof(c);
+        }
+        std::streamsize xsputn(const char *, std::streamsize n) override {
+            return n;
+        }
+};
+
+struct Result {
+    std::string     name;
+    unsigned        num_threads;
+    unsigned long   num_records;
+    double          seconds;
+};
+
+/**
+ * Runs <code>body</code> on each of <code>num_threads</code> threads,
+ * started together, and times the whole run.
+ *
+ * @param body          called with the thread index and number of records
+ * @param num_threads   number of threads
+ * @param num_records   records logged by each thread
+ */
+double time_threads(const std::function<void (unsigned, unsigned long)> & body,
+        unsigned num_threads,
+        unsigned long num_records) {
+    if (num_threads == 1) {
+        auto start = std::chrono::steady_clock::now();
+        body(0, num_records);
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+    std::vector<std::thread> threads;
+    std::atomic<unsigned> ready(0);
+    std::atomic<bool> go(false);
+    for (unsigned t = 0; t < num_threads; ++t) {
+        threads.emplace_back([&, t] {
+            ready.fetch_add(1);
+            while (!go.load()) {
+                std::this_thread::yield();
+            }
+            body(t, num_records);
+        });
+    }
+    while (ready.load() != num_threads) {
+        std::this_thread::yield();
+    }
+    auto start = std::chrono::steady_clock::now();
+    go.store(true);
+    for (auto & thread : threads) {
+        thread.join();
+    }
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+/**
+ * Logs a typical record (a string, an integer and a floating point value)
+ * to <code>logger</code> at INFO.
+ */
+void log_records(colugo::Logger & logger, unsigned thread_index, unsigned long num_records) {
+    for (unsigned long i = 0; i < num_records; ++i) {
+        logger.info("thread ", thread_index, " processed item ", i, " in ", 0.25, " s");
+    }
+}
+
+void report(std::ostream & out, const std::string & label, const Result & result) {
+    double total = static_cast<double>(result.num_records) * result.num_threads;
+    out << label
+        << '\t' << result.name
+        << '\t' << result.num_threads
+        << '\t' << result.num_records * result.num_threads
+        << '\t' << (result.seconds * 1e9 / total)
+        << '\t' << static_cast<unsigned long>(total / result.seconds)
+        << '\n';
+}
+
+} // namespace
+
+int main(int argc, const char * argv[]) {
+    unsigned long num_records = 200000;
+    unsigned long max_threads = 64;
+    std::string label = "-";
+    std::string output_path;
+    std::string filter;
+
+    colugo::OptionParser parser("colugo-logger-bench 1.0",
+            "Measures the throughput of colugo::Logger and console output.",
+            "%prog [options]");
+    parser.add_option<unsigned long>(&num_records, "-n", "--num-records",
+            "Records logged per thread in each benchmark (default: %default).", "N");
+    parser.add_option<unsigned long>(&max_threads, "-t", "--max-threads",
+            "Largest number of threads in contention benchmarks (default: %default).", "N");
+    parser.add_option<std::string>(&label, "-l", "--label",
+            "Label identifying this run in the results, e.g., a commit hash (default: '%default').", "LABEL");
+    parser.add_option<std::string>(&output_path, "-o", "--output",
+            "Append results to this file as well as writing them to standard output.", "FILE");
+    parser.add_option<std::string>(&filter, "-f", "--filter",
+            "Only run benchmarks whose names contain this string.", "TEXT");
+    parser.parse(argc, argv);
+
+    std::ofstream output_file;
+    if (!output_path.empty()) {
+        output_file.open(output_path, std::ios::app);
+        if (!output_file) {
+            colugo::console::abort("Failed to open file: ", output_path);
+        }
+    }
+    auto emit = [&](const Result & result) {
+        report(std::cout, label, result);
+        std::cout.flush();
+        if (output_file.is_open()) {
+            report(output_file, label, result);
+            output_file.flush();
+        }
+    };
+    auto selected = [&](const std::string & name) {
+        return filter.empty() || name.find(filter) != std::string::npos;
+    };
+
+    std::cout << "label\tbenchmark\tthreads\trecords\tns/record\trecords/s\n";
+
+    // single-threaded dispatch and formatting cost
+
+    struct Case {
+        const char *    name;
+        unsigned        num_channels;
+        int             timestamp;
+        bool            disabled;
+    };
+    const Case cases[] = {
+        {"log.0-channels",          0, 0, false},
+        {"log.1-channel",           1, 0, false},
+        {"log.4-channels",          4, 0, false},
+        {"log.1-channel.timestamp", 1, 1, false},
+        {"log.disabled-level",      1, 0, true},
+    };
+    for (const Case & c : cases) {
+        if (!selected(c.name)) {
+            continue;
+        }
+        colugo::Logger logger(c.name);
+        colugo::Logger::LoggingLevel level = c.disabled
+            ? colugo::Logger::LoggingLevel::WARNING
+            : colugo::Logger::LoggingLevel::INFO;
+        for (unsigned i = 0; i < c.num_channels; ++i) {
+            logger.add_channel(std::make_shared<NullLogSink>(), level, c.timestamp);
+        }
+        double seconds = time_threads([&](unsigned t, unsigned long n) { log_records(logger, t, n); },
+                1, num_records);
+        emit(Result{c.name, 1, num_records, seconds});
+    }
+
+    // writing to a file descriptor, shared by increasing numbers of threads
+
+    for (unsigned long num_threads = 1; num_threads <= max_threads; num_threads *= 2) {
+        std::string name = "log.devnull";
+        if (!selected(name)) {
+            break;
+        }
+        colugo::Logger logger(name);
+        logger.add_channel(colugo::FdLogSink::open("/dev/null"), colugo::Logger::LoggingLevel::INFO, 1);
+        unsigned long per_thread = std::max<unsigned long>(num_records / num_threads, 1000);
+        double seconds = time_threads([&](unsigned t, unsigned long n) { log_records(logger, t, n); },
+                static_cast<unsigned>(num_threads), per_thread);
+        emit(Result{name, static_cast<unsigned>(num_threads), per_thread, seconds});
+    }
+
+    // console output, with std::cout discarding everything
+
+    if (selected("console.out_ln")) {
+        NullStreamBuf null_buf;
+        std::streambuf * saved = std::cout.rdbuf(&null_buf);
+        double seconds = time_threads([&](unsigned t, unsigned long n) {
+                    for (unsigned long i = 0; i < n; ++i) {
+                        colugo::console::out_ln("thread ", t, " processed item ", i, " in ", 0.25, " s");
+                    }
+                }, 1, num_records);
+        std::cout.rdbuf(saved);
+        emit(Result{"console.out_ln", 1, num_records, seconds});
+    }
+
+    return 0;
+}
@@ -0,0 +1,281 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright 2013 Jeet Sukumaran.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program. If not, see <http://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+// Measures output formatting throughput of stream::write and the
+// alternatives to it, on the same workload: rows of an integer, a floating
+// point value, a short string and a vector of four integers, written to
+// /dev/null and to a file.
+//
+// Results are printed as tab-separated lines:
+//
+//      label   benchmark   target   rows   bytes   ns/field   bytes/s
+//
+// where the label (e.g., a commit hash) identifies the run, so that results
+// appended to a single file with "-o" can be compared across commits. Every
+// backend produces the same bytes, so the "bytes" column should agree
+// within each target.
+//
+// Build:
+//
+//      c++ -std=c++17 -O2 -pthread -Iinclude -o colugo-stream-bench bench/stream_bench.cpp
+
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <colugo/cmdopt.hpp>
+#include <colugo/console.hpp>
+#include <colugo/stream.hpp>
+
+namespace {
+
+// fields per row: integer, floating point value, string, and four vector
+// elements
+const unsigned FIELDS_PER_ROW = 7;
+
+struct Row {
+    int                 id;
+    double              value;
+    std::string         name;
+    std::vector<int>    counts;
+};
+
+std::vector<Row> make_rows(unsigned long num_rows) {
+    static const char * names[] = {"alpha", "beta", "gamma", "delta", "epsilon"};
+    std::vector<Row> rows;
+    rows.reserve(num_rows);
+    unsigned long state = 12345;
+    for (unsigned long i = 0; i < num_rows; ++i) {
+        state = state * 6364136223846793005UL + 1442695040888963407UL;
+        Row row;
+        row.id = static_cast<int>(i);
+        row.value = static_cast<double>(state >> 11) / 9007199254740992.0 * 1000.0;
+        row.name = names[i % 5];
+        row.counts = {static_cast<int>(state >> 60), static_cast<int>(i % 1000), -static_cast<int>(i % 7), 42};
+        rows.push_back(std::move(row));
+    }
+    return rows;
+}
+
+/**
+ * Plain insertion operators on a std::ofstream, with no colugo code
+ * involved: the baseline for stream::write.
+ */
+void write_operator(const std::string & path, const std::vector<Row> & rows) {
+    std::ofstream out(path);
+    for (const Row & row : rows) {
+        out << row.id << '\t' << row.value << '\t' << row.name << '\t';
+        for (std::size_t i = 0; i < row.counts.size(); ++i) {
+            if (i > 0) {
+                out << ", ";
+            }
+            out << row.counts[i];
+        }
+        out << '\n';
+    }
+}
+
+/**
+ * stream::write to a std::ofstream, formatting each row into a local
+ * buffer written to the stream in a single call.
+ */
+void write_ostream(const std::string & path, const std::vector<Row> & rows) {
+    std::ofstream out(path);
+    for (const Row & row : rows) {
+        colugo::stream::write(out, row.id, '\t', row.value, '\t', row.name, '\t', row.counts, '\n');
+    }
+}
+
+/**
+ * The same output with fprintf.
+ */
+void write_printf(const std::string & path, const std::vector<Row> & rows) {
+    std::FILE * out = std::fopen(path.c_str(), "w");
+    for (const Row & row : rows) {
+        std::fprintf(out, "%d\t%g\t%s\t%d, %d, %d, %d\n", row.id, row.value, row.name.c_str(),
+                row.counts[0], row.counts[1], row.counts[2], row.counts[3]);
+    }
+    std::fclose(out);
+}
+
+/**
+ * The formatting of stream::write_fd (to_chars into a stream::Buffer), but
+ * with one buffer kept across rows, so that it is written out with
+ * write(2) only when full rather than once per row.
+ */
+void write_to_chars(const std::string & path, const std::vector<Row> & rows) {
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    {
+        colugo::stream::Buffer buffer(fd);
+        std::ostream fallback_out(&buffer);
+        bool fast = true;
+        for (const Row & row : rows) {
+            colugo::stream::write_arg(buffer, fallback_out, fast, row.id);
+            colugo::stream::write_arg(buffer, fallback_out, fast, '\t');
+            colugo::stream::write_arg(buffer, fallback_out, fast, row.value);
+            colugo::stream::write_arg(buffer, fallback_out, fast, '\t');
+            colugo::stream::write_arg(buffer, fallback_out, fast, row.name);
+            colugo::stream::write_arg(buffer, fallback_out, fast, '\t');
+            colugo::stream::write_arg(buffer, fallback_out, fast, row.counts);
+            colugo::stream::write_arg(buffer, fallback_out, fast, '\n');
+        }
+    }
+    ::close(fd);
+}
+
+/**
+ * Hand-formatting with to_chars into a large buffer that is written
+ * directly with write(2) when full: the lower bound for the other
+ * backends.
+ */
+void write_direct(const std::string & path, const std::vector<Row> & rows) {
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    std::vector<char> buffer(1 << 16);
+    char * begin = buffer.data();
+    char * end = begin + buffer.size();
+    char * pos = begin;
+    for (const Row & row : rows) {
+        if (end - pos < 256 + static_cast<std::ptrdiff_t>(row.name.size())) {
+            colugo::stream::FdWriter::write_all(fd, begin, static_cast<std::size_t>(pos - begin));
+            pos = begin;
+        }
+        pos = std::to_chars(pos, end, row.id).ptr;
+        *pos++ = '\t';
+        pos = std::to_chars(pos, end, row.value, std::chars_format::general, 6).ptr;
+        *pos++ = '\t';
+        pos = std::copy(row.name.begin(), row.name.end(), pos);
+        *pos++ = '\t';
+        for (std::size_t i = 0; i < row.counts.size(); ++i) {
+            if (i > 0) {
+                *pos++ = ',';
+                *pos++ = ' ';
+            }
+            pos = std::to_chars(pos, end, row.counts[i]).ptr;
+        }
+        *pos++ = '\n';
+    }
+    colugo::stream::FdWriter::write_all(fd, begin, static_cast<std::size_t>(pos - begin));
+    ::close(fd);
+}
+
+unsigned long file_size(const std::string & path) {
+    struct stat st;
+    return ::stat(path.c_str(), &st) == 0 ? static_cast<unsigned long>(st.st_size) : 0;
+}
+
+} // namespace
+
+int main(int argc, const char * argv[]) {
+    unsigned long num_rows = 1000000;
+    std::string label = "-";
+    std::string output_path;
+    std::string scratch_path = "colugo-stream-bench.tmp";
+    std::string filter;
+
+    colugo::OptionParser parser("colugo-stream-bench 1.0",
+            "Measures the throughput of stream::write and alternative output backends.",
+            "%prog [options]");
+    parser.add_option<unsigned long>(&num_rows, "-n", "--num-rows",
+            "Rows written in each benchmark (default: %default).", "N");
+    parser.add_option<std::string>(&label, "-l", "--label",
+            "Label identifying this run in the results, e.g., a commit hash (default: '%default').", "LABEL");
+    parser.add_option<std::string>(&output_path, "-o", "--output",
+            "Append results to this file as well as writing them to standard output.", "FILE");
+    parser.add_option<std::string>(&scratch_path, "-s", "--scratch-file",
+            "File written (and removed) by the file benchmarks (default: '%default').", "FILE");
+    parser.add_option<std::string>(&filter, "-f", "--filter",
+            "Only run benchmarks whose names contain this string.", "TEXT");
+    parser.parse(argc, argv);
+
+    std::ofstream output_file;
+    if (!output_path.empty()) {
+        output_file.open(output_path, std::ios::app);
+        if (!output_file) {
+            colugo::console::abort("Failed to open file: ", output_path);
+        }
+    }
+
+    std::vector<Row> rows = make_rows(num_rows);
+
+    struct Backend {
+        const char *                                                            name;
+        std::function<void (const std::string &, const std::vector<Row> &)>    run;
+    };
+    const Backend backends[] = {
+        {"operator<<",      write_operator},
+        {"stream.write",    write_ostream},
+        {"printf",          write_printf},
+        {"to_chars",        write_to_chars},
+        {"direct",          write_direct},
+    };
+    struct Target {
+        const char *    name;
+        std::string     path;
+    };
+    const Target targets[] = {
+        {"devnull",     "/dev/null"},
+        {"file",        scratch_path},
+    };
+
+    std::cout << "label\tbenchmark\ttarget\trows\tbytes\tns/field\tbytes/s\n";
+    for (const Target & target : targets) {
+        for (const Backend & backend : backends) {
+            std::string name = std::string(backend.name) + "." + target.name;
+            if (!filter.empty() && name.find(filter) == std::string::npos) {
+                continue;
+            }
+            auto start = std::chrono::steady_clock::now();
+            backend.run(target.path, rows);
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            // /dev/null has no size, so count the bytes through a file once
+            if (target.path == "/dev/null") {
+                backend.run(scratch_path, rows);
+            }
+            unsigned long bytes = file_size(scratch_path);
+            double num_fields = static_cast<double>(num_rows) * FIELDS_PER_ROW;
+            std::ostringstream result;
+            result << label
+                << '\t' << backend.name
+                << '\t' << target.name
+                << '\t' << num_rows
+                << '\t' << bytes
+                << '\t' << (seconds * 1e9 / num_fields)
+                << '\t' << static_cast<unsigned long>(bytes / seconds)
+                << '\n';
+            std::cout << result.str();
+            std::cout.flush();
+            if (output_file.is_open()) {
+                output_file << result.str();
+                output_file.flush();
+            }
+        }
+    }
+    ::unlink(scratch_path.c_str());
+
+    return 0;
+}
@@ -19,6 +19,7 @@ inline void colugo_assertion_failed(char const * expr, char const * function, ch
 #if defined(ASSERT_RAISES_EXCEPTION) && ASSERT_RAISES_EXCEPTION
     throw std::runtime_error("Assertion Error");
 #else
+    console::run_abort_hook();
     std::exit(EXIT_FAILURE);
 #endif
 }
@@ -40,6 +41,7 @@ inline void colugo_assert_approx_eq_failed(char const * x,
 #if defined(ASSERT_RAISES_EXCEPTION) && ASSERT_RAISES_EXCEPTION
     throw std::runtime_error("Assertion Error");
 #else
+    console::run_abort_hook();
     std::exit(EXIT_FAILURE);
 #endif
 }
@@ -0,0 +1,249 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright 2013 Jeet Sukumaran.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program. If not, see <http://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <vector>
+
+#if !defined(COLUGO_CHARSCAN_HPP)
+#define COLUGO_CHARSCAN_HPP
+
+#if (defined(__x86_64__) || defined(_M_X64)) && (defined(__GNUC__) || defined(__clang__))
+#define COLUGO_CHARSCAN_X86 1
+#include <immintrin.h>
+#endif
+
+namespace colugo {
+namespace textutil {
+
+/**
+ * A small set of characters (e.g., field delimiters) to scan text for.
+ */
+class CharSet {
+
+    public:
+        /**
+         * Largest set scanned with vector instructions; larger sets are
+         * scanned one byte at a time.
+         */
+        static const unsigned MAX_VECTOR_CHARS = 16;
+
+        explicit CharSet(std::string_view chars)
+            : chars_(chars)
+            , num_unique_(0)
+            , is_vectorizable_(true) {
+            for (char c : chars) {
+                if (std::memchr(this->unique_, c, this->num_unique_) != nullptr) {
+                    continue;
+                }
+                if (this->num_unique_ == MAX_VECTOR_CHARS) {
+                    this->is_vectorizable_ = false;
+                    break;
+                }
+                this->unique_[this->num_unique_++] = c;
+            }
+        }
+
+        bool contains(char c) const {
+            return this->chars_.find(c) != std::string_view::npos;
+        }
+
+        /**
+         * Returns <code>true</code> if the set can be scanned for with
+         * vector instructions.
+         */
+        bool is_vectorizable() const {
+            return this->is_vectorizable_;
+        }
+
+        const char * unique_chars() const {
+            return this->unique_;
+        }
+
+        unsigned num_unique_chars() const {
+            return this->num_unique_;
+        }
+
+        std::string_view chars() const {
+            return this->chars_;
+        }
+
+    private:
+        std::string_view    chars_;
+        char                unique_[MAX_VECTOR_CHARS];
+        unsigned            num_unique_;
+        bool                is_vectorizable_;
+
+}; // CharSet
+
+///////////////////////////////////////////////////////////////////////////////
+// Block scanning kernels
+//
+// Each kernel returns a bit mask of the bytes of a 64-byte block that are in
+// the set, bit i set if block[i] is in the set.
+
+typedef std::uint64_t (*CharMaskKernel)(const char * block, const CharSet & set);
+
+inline std::uint64_t char_mask_scalar(const char * block, const CharSet & set) {
+    std::uint64_t mask = 0;
+    for (unsigned i = 0; i < 64; ++i) {
+        if (set.contains(block[i])) {
+            mask |= std::uint64_t(1) << i;
+        }
+    }
+    return mask;
+}
+
+#if defined(COLUGO_CHARSCAN_X86)
+
+inline std::uint64_t char_mask_sse2(const char * block, const CharSet & set) {
+    std::uint64_t mask = 0;
+    for (unsigned j = 0; j < 4; ++j) {
+        __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(block + 16 * j));
+        __m128i found = _mm_setzero_si128();
+        for (unsigned k = 0; k < set.num_unique_chars(); ++k) {
+            found = _mm_or_si128(found, _mm_cmpeq_epi8(bytes, _mm_set1_epi8(set.unique_chars()[k])));
+        }
+        mask |= static_cast<std::uint64_t>(static_cast<unsigned>(_mm_movemask_epi8(found))) << (16 * j);
+    }
+    return mask;
+}
+
+__attribute__((target("avx2")))
+inline std::uint64_t char_mask_avx2(const char * block, const CharSet & set) {
+    __m256i lo = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(block));
+    __m256i hi = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(block + 32));
+    __m256i found_lo = _mm256_setzero_si256();
+    __m256i found_hi = _mm256_setzero_si256();
+    for (unsigned k = 0; k < set.num_unique_chars(); ++k) {
+        __m256i c = _mm256_set1_epi8(set.unique_chars()[k]);
+        found_lo = _mm256_or_si256(found_lo, _mm256_cmpeq_epi8(lo, c));
+        found_hi = _mm256_or_si256(found_hi, _mm256_cmpeq_epi8(hi, c));
+    }
+    return static_cast<std::uint64_t>(static_cast<std::uint32_t>(_mm256_movemask_epi8(found_lo)))
+        | (static_cast<std::uint64_t>(static_cast<std::uint32_t>(_mm256_movemask_epi8(found_hi))) << 32);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+inline std::uint64_t char_mask_avx512(const char * block, const CharSet & set) {
+    __m512i bytes = _mm512_loadu_si512(block);
+    __mmask64 found = 0;
+    for (unsigned k = 0; k < set.num_unique_chars(); ++k) {
+        found |= _mm512_cmpeq_epi8_mask(bytes, _mm512_set1_epi8(set.unique_chars()[k]));
+    }
+    return static_cast<std::uint64_t>(found);
+}
+
+#endif
+
+/**
+ * Returns the fastest block scanning kernel supported by this CPU for
+ * sets that can be vectorized. Selected once, on first use.
+ */
+inline CharMaskKernel vector_char_mask_kernel() {
+#if defined(COLUGO_CHARSCAN_X86)
+    static const CharMaskKernel kernel = []() -> CharMaskKernel {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512bw")) {
+            return &char_mask_avx512;
+        } else if (__builtin_cpu_supports("avx2")) {
+            return &char_mask_avx2;
+        }
+        return &char_mask_sse2;
+    }();
+    return kernel;
+#else
+    return &char_mask_scalar;
+#endif
+}
+
+/**
+ * Returns a bit mask of the characters of <code>s</code>, starting at
+ * <code>pos</code>, that are in <code>set</code>: bit i is set if
+ * <code>s[pos + i]</code> is in the set. At most 64 characters are
+ * examined.
+ *
+ * @param s         text to scan
+ * @param pos       position of first character examined
+ * @param set       characters to look for
+ * @param kernel    block scanning kernel
+ * @return          bit mask of matching characters
+ */
+inline std::uint64_t char_mask(std::string_view s, std::size_t pos, const CharSet & set, CharMaskKernel kernel) {
+    std::size_t size = s.size() - pos;
+    if (size >= 64) {
+        return kernel(s.data() + pos, set);
+    }
+    // short tail: scan a padded copy, ignoring the padding
+    char block[64] = {};
+    std::memcpy(block, s.data() + pos, size);
+    return kernel(block, set) & ((std::uint64_t(1) << size) - 1);
+}
+
+/**
+ * Returns the kernel to use for a given set: vectorized if possible,
+ * otherwise scalar.
+ */
+inline CharMaskKernel char_mask_kernel(const CharSet & set) {
+    return set.is_vectorizable() ? vector_char_mask_kernel() : &char_mask_scalar;
+}
+
+/**
+ * Returns the position of the first character of <code>s</code>, at or
+ * after <code>pos</code>, that is in <code>set</code>, or
+ * <code>std::string_view::npos</code> if there is none. Equivalent to
+ * <code>s.find_first_of(set.chars(), pos)</code>, but examines 64
+ * characters at a time.
+ */
+inline std::size_t find_first_of(std::string_view s, std::size_t pos, const CharSet & set) {
+    CharMaskKernel kernel = char_mask_kernel(set);
+    for (; pos < s.size(); pos += 64) {
+        std::uint64_t mask = char_mask(s, pos, set, kernel);
+        if (mask != 0) {
+            return pos + static_cast<std::size_t>(__builtin_ctzll(mask));
+        }
+    }
+    return std::string_view::npos;
+}
+
+/**
+ * Finds the positions of all characters of <code>s</code> that are in
+ * <code>set</code>, replacing the contents of a caller-owned vector.
+ *
+ * @param s         text to scan
+ * @param set       characters to look for
+ * @param offsets   destination for positions, in increasing order
+ */
+inline void find_all_of(std::string_view s, const CharSet & set, std::vector<std::size_t> & offsets) {
+    offsets.clear();
+    CharMaskKernel kernel = char_mask_kernel(set);
+    for (std::size_t pos = 0; pos < s.size(); pos += 64) {
+        std::uint64_t mask = char_mask(s, pos, set, kernel);
+        while (mask != 0) {
+            offsets.push_back(pos + static_cast<std::size_t>(__builtin_ctzll(mask)));
+            mask &= mask - 1;
+        }
+    }
+}
+
+} // namespace textutil
+} // namespace colugo
+
+#endif
@@ -28,6 +28,7 @@
 #include <stdexcept>
 #include <iomanip>
 #include <string.h>
+#include "parse.hpp"
 #include "textutil.hpp"
 #include "filesys.hpp"
 
@@ -309,11 +310,17 @@ class TypedOptionArg : public OptionArg {
          * @param val_str   string representation of the value for this option
          */
         virtual void process_value_string(const std::string& val_str) {
-            std::istringstream istr(val_str);
             T temp;
-            istr >> std::noskipws;
-            istr >> temp;
-            if (!istr.fail() && istr.eof()) {
+            bool converted = false;
+            if constexpr (textutil::is_parseable<T>()) {
+                converted = textutil::parse(val_str, temp) == textutil::ParseError::NONE;
+            } else {
+                std::istringstream istr(val_str);
+                istr >> std::noskipws;
+                istr >> temp;
+                converted = !istr.fail() && istr.eof();
+            }
+            if (converted) {
                 *this->store_ = temp;
                 this->set_is_set(true);
             } else {
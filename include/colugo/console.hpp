@@ -20,12 +20,120 @@
 #ifndef COLUGO_CONSOLE_HPP
 #define COLUGO_CONSOLE_HPP
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
 #include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unistd.h>
 #include "textutil.hpp"
 #include "stream.hpp"
 
 namespace colugo { namespace console {
 
+///////////////////////////////////////////////////////////////////////////////
+// Buffering
+
+enum class Buffering {
+    LINE,       // flush after every line (the default)
+    FULL,       // flush only when the buffer is full, at exit and on abort
+    AUTO,       // FULL for standard output if not a terminal, LINE otherwise
+};
+
+/**
+ * Returns <code>true</code> if a file descriptor refers to a terminal.
+ */
+inline bool is_tty(int fd) {
+    return ::isatty(fd) == 1;
+}
+
+inline std::atomic<bool> & flush_out_lines_() {
+    static std::atomic<bool> flush_lines(true);
+    return flush_lines;
+}
+
+inline std::atomic<bool> & flush_err_lines_() {
+    static std::atomic<bool> flush_lines(true);
+    return flush_lines;
+}
+
+/**
+ * Writes out anything buffered for standard output and standard error.
+ */
+inline void flush() {
+    std::cout.flush();
+    std::cerr.flush();
+}
+
+/**
+ * Sets how standard output and standard error are buffered. Writing
+ * millions of lines through the default line buffering costs a system call
+ * per line; with FULL buffering, std::cout and std::cerr are switched to a
+ * large buffer written to the file descriptor directly, and are flushed
+ * only when full, at exit, and before console::abort(). AUTO does the same
+ * for std::cout when standard output is not a terminal, but leaves
+ * std::cerr line-buffered, so that diagnostics are not lost if the program
+ * dies without reaching exit. Output written with C stdio functions is
+ * then no longer kept in order with output written to a fully buffered
+ * stream through the console (or iostreams).
+ *
+ * Must be called before anything is written.
+ *
+ * @param mode              buffering mode
+ * @param buffer_size       size of each buffer for FULL buffering
+ * @param sync_with_stdio   if <code>false</code>, also calls
+ *                          std::ios::sync_with_stdio(false)
+ */
+inline void set_buffering(Buffering mode=Buffering::AUTO,
+        std::size_t buffer_size=1 << 20,
+        bool sync_with_stdio=true) {
+    if (!sync_with_stdio) {
+        std::ios::sync_with_stdio(false);
+    }
+    bool buffer_out = mode == Buffering::FULL || (mode == Buffering::AUTO && !is_tty(STDOUT_FILENO));
+    bool buffer_err = mode == Buffering::FULL;
+    // buffers are never freed, since std::cout and std::cerr are still
+    // flushed after static objects have been destroyed
+    static stream::FdStreamBuf * out_buf = nullptr;
+    static stream::FdStreamBuf * err_buf = nullptr;
+    if (buffer_out && out_buf == nullptr) {
+        std::cout.flush();
+        out_buf = new stream::FdStreamBuf(STDOUT_FILENO, buffer_size);
+        std::cout.rdbuf(out_buf);
+    }
+    if (buffer_err && err_buf == nullptr) {
+        std::cerr.flush();
+        err_buf = new stream::FdStreamBuf(STDERR_FILENO, buffer_size);
+        std::cerr.rdbuf(err_buf);
+        std::cerr.unsetf(std::ios_base::unitbuf);
+    }
+    flush_out_lines_().store(!buffer_out);
+    flush_err_lines_().store(!buffer_err);
+    static bool registered = false;
+    if ((buffer_out || buffer_err) && !registered) {
+        registered = true;
+        std::atexit(&flush);
+    }
+}
+
+inline void end_out_line_() {
+    std::cout.put('\n');
+    if (flush_out_lines_().load(std::memory_order_relaxed)) {
+        std::cout.flush();
+    }
+}
+
+inline void end_err_line_() {
+    std::cerr.put('\n');
+    if (flush_err_lines_().load(std::memory_order_relaxed)) {
+        std::cerr.flush();
+    }
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // Printing
 
@@ -37,16 +145,16 @@ inline void out(const Types&... args) {
 template <typename... Types>
 inline void out_ln(const Types&... args) {
     colugo::console::out(args...);
-    std::cout << std::endl;
+    colugo::console::end_out_line_();
 }
 
 template <typename... Types>
 inline void out_wrapped(const Types&... args) {
-    std::ostringstream oss;
-    colugo::stream::write(oss, args...);
-    auto text = colugo::textutil::textwrap(oss.str(), 78);
-    std::cout << text;
-    std::cout << std::endl;
+    colugo::textutil::WrappingStreamBuf wrapping_buf(std::cout.rdbuf(), 78);
+    std::ostream wrapping_out(&wrapping_buf);
+    colugo::stream::write(wrapping_out, args...);
+    wrapping_buf.finish();
+    colugo::console::end_out_line_();
 }
 
 template <typename... Types>
@@ -57,25 +165,240 @@ inline void err(const Types&... args) {
 template <typename... Types>
 inline void err_line(const Types&... args) {
     colugo::console::err(args...);
-    std::cerr << std::endl;
+    colugo::console::end_err_line_();
 }
 
 template <typename... Types>
 inline void err_wrapped(const Types&... args) {
-    std::ostringstream oss;
-    colugo::stream::write(oss, args...);
-    auto text = colugo::textutil::textwrap(oss.str(), 78);
-    std::cerr << text;
-    std::cerr << std::endl;
+    colugo::textutil::WrappingStreamBuf wrapping_buf(std::cerr.rdbuf(), 78);
+    std::ostream wrapping_out(&wrapping_buf);
+    colugo::stream::write(wrapping_out, args...);
+    wrapping_buf.finish();
+    colugo::console::end_err_line_();
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// Progress
+
+/**
+ * Progress reporter for long-running jobs.
+ *
+ * Worker threads call add() as items are processed, which costs one
+ * uncontended atomic increment: each thread counts into its own
+ * cache-line-sized stripe of the counter. A background thread reads the
+ * counter at a fixed interval and, if standard error is a terminal,
+ * redraws a single status line:
+ *
+ *      reading: 1,234,567 / 10,000,000 (12.3%)  456,789/s  ETA 0:00:19
+ *
+ * Otherwise, a summary line is written at a longer interval. A final line
+ * is written by finish() (or on destruction).
+ */
+class Progress {
+
+    public:
+        /**
+         * @param label                 description of the job
+         * @param total                 expected number of items (0 if
+         *                              unknown)
+         * @param redraw_interval_ms    interval between status line updates
+         *                              on a terminal
+         * @param summary_interval_ms   interval between summary lines when
+         *                              not on a terminal
+         */
+        Progress(const std::string & label,
+                unsigned long total=0,
+                unsigned long redraw_interval_ms=100,
+                unsigned long summary_interval_ms=10000)
+            : label_(label)
+            , total_(total)
+            , is_tty_(is_tty(STDERR_FILENO))
+            , interval_(is_tty_ ? redraw_interval_ms : summary_interval_ms)
+            , start_(std::chrono::steady_clock::now())
+            , stopping_(false)
+            , finished_(false) {
+            this->reporter_ = std::thread(&Progress::run_reporter_, this);
+        }
+
+        ~Progress() {
+            this->finish();
+        }
+
+        Progress(const Progress &) = delete;
+        Progress & operator=(const Progress &) = delete;
+
+        /**
+         * Records that items have been processed. Safe to call from any
+         * number of threads.
+         *
+         * @param num_items     number of items processed
+         */
+        void add(unsigned long num_items=1) {
+            this->stripes_[Progress::stripe_index_()].count.fetch_add(num_items, std::memory_order_relaxed);
+        }
+
+        void set_total(unsigned long total) {
+            this->total_.store(total, std::memory_order_relaxed);
+        }
+
+        /** Returns the number of items processed so far. */
+        unsigned long count() const {
+            unsigned long sum = 0;
+            for (auto & stripe : this->stripes_) {
+                sum += stripe.count.load(std::memory_order_relaxed);
+            }
+            return sum;
+        }
+
+        /**
+         * Stops reporting, and writes the final status.
+         */
+        void finish() {
+            {
+                std::lock_guard<std::mutex> lock(this->mutex_);
+                if (this->finished_) {
+                    return;
+                }
+                this->finished_ = true;
+                this->stopping_ = true;
+            }
+            this->stop_cv_.notify_one();
+            this->reporter_.join();
+            std::string line = this->status_line_(true);
+            if (this->is_tty_) {
+                line.insert(0, "\r");
+                line += "\x1b[K";
+            }
+            line += '\n';
+            std::cerr.write(line.data(), static_cast<std::streamsize>(line.size()));
+            std::cerr.flush();
+        }
+
+    private:
+        static const unsigned NUM_STRIPES = 16;
+
+        struct alignas(64) Stripe {
+            std::atomic<unsigned long>  count{0};
+        };
+
+        static unsigned stripe_index_() {
+            static std::atomic<unsigned> next_index(0);
+            thread_local unsigned index = next_index.fetch_add(1, std::memory_order_relaxed) % NUM_STRIPES;
+            return index;
+        }
+
+        static void append_count_(std::string & text, unsigned long n) {
+            std::string digits = std::to_string(n);
+            for (std::size_t i = 0; i < digits.size(); ++i) {
+                if (i > 0 && (digits.size() - i) % 3 == 0) {
+                    text += ',';
+                }
+                text += digits[i];
+            }
+        }
+
+        static void append_duration_(std::string & text, double seconds) {
+            unsigned long total = static_cast<unsigned long>(seconds + 0.5);
+            char buffer[32];
+            std::snprintf(buffer, sizeof(buffer), "%lu:%02lu:%02lu", total / 3600, (total / 60) % 60, total % 60);
+            text += buffer;
+        }
+
+        std::string status_line_(bool final) const {
+            unsigned long count = this->count();
+            unsigned long total = this->total_.load(std::memory_order_relaxed);
+            double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - this->start_).count();
+            double rate = elapsed > 0 ? count / elapsed : 0;
+            std::string line = this->label_;
+            line += ": ";
+            Progress::append_count_(line, count);
+            if (total > 0) {
+                line += " / ";
+                Progress::append_count_(line, total);
+                char percent[16];
+                std::snprintf(percent, sizeof(percent), " (%.1f%%)", 100.0 * count / total);
+                line += percent;
+            }
+            line += "  ";
+            Progress::append_count_(line, static_cast<unsigned long>(rate + 0.5));
+            line += "/s";
+            if (final) {
+                line += "  in ";
+                Progress::append_duration_(line, elapsed);
+            } else if (total > count && rate > 0) {
+                line += "  ETA ";
+                Progress::append_duration_(line, (total - count) / rate);
+            }
+            return line;
+        }
+
+        void run_reporter_() {
+            std::unique_lock<std::mutex> lock(this->mutex_);
+            while (!this->stop_cv_.wait_for(lock, std::chrono::milliseconds(this->interval_),
+                        [this] { return this->stopping_; })) {
+                std::string line = this->status_line_(false);
+                if (this->is_tty_) {
+                    line.insert(0, "\r");
+                    line += "\x1b[K";
+                } else {
+                    line += '\n';
+                }
+                std::cerr.write(line.data(), static_cast<std::streamsize>(line.size()));
+                std::cerr.flush();
+            }
+        }
+
+    private:
+        Stripe                                  stripes_[NUM_STRIPES];
+        std::string                             label_;
+        std::atomic<unsigned long>              total_;
+        bool                                    is_tty_;
+        unsigned long                           interval_;
+        std::chrono::steady_clock::time_point   start_;
+        std::mutex                              mutex_;
+        std::condition_variable                 stop_cv_;
+        bool                                    stopping_;
+        bool                                    finished_;
+        std::thread                             reporter_;
+
+}; // Progress
+
 ///////////////////////////////////////////////////////////////////////////////
 // Program control
 
+typedef void (*AbortHook)();
+
+inline std::atomic<AbortHook> & abort_hook_() {
+    static std::atomic<AbortHook> hook(nullptr);
+    return hook;
+}
+
+/**
+ * Sets a function to be called just before the program exits through
+ * console::abort(), Logger::abort() or a failed assertion (e.g., to dump
+ * diagnostic state).
+ *
+ * @param hook  function to call, or <code>nullptr</code> to clear
+ * @return      the hook it replaces, which <code>hook</code> may call in
+ *              turn
+ */
+inline AbortHook set_abort_hook(AbortHook hook) {
+    return abort_hook_().exchange(hook);
+}
+
+inline void run_abort_hook() {
+    AbortHook hook = abort_hook_().exchange(nullptr);
+    if (hook != nullptr) {
+        hook();
+    }
+}
+
 template <typename... Types>
 inline void abort(const Types&... args) {
+    std::cout.flush();
     colugo::console::err(args...);
     std::cerr << std::endl;
+    colugo::console::run_abort_hook();
     exit(EXIT_FAILURE);
 }
 
@@ -0,0 +1,366 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright 2013 Jeet Sukumaran.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program. If not, see <http://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <atomic>
+#include <csignal>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include "console.hpp"
+#include "logbinary.hpp"
+#include "logdecode.hpp"
+#include "logger.hpp"
+
+#if !defined(COLUGO_FLIGHTREC_HPP)
+#define COLUGO_FLIGHTREC_HPP
+
+namespace colugo {
+
+/**
+ * Always-on, in-memory record of the most recent log records of each
+ * thread, at every level, for dumping when the program fails.
+ *
+ * Once enabled, every record at or above the capture level is copied, in
+ * binary form (see logbinary.hpp) and so without any text formatting, into
+ * a fixed-size ring of slots owned by the logging thread. Nothing is written
+ * out unless the program dies: the rings are then rendered as text, merged
+ * in time order, to standard error from console::abort(), Logger::abort(),
+ * failed assertions, and (if requested) fatal signals. Records larger than
+ * a slot are truncated.
+ *
+ * Typical use is to run with channels at WARNING while capturing DEBUG:
+ *
+ *      colugo::FlightRecorder::enable(4096, 256, colugo::Logger::LoggingLevel::DEBUG);
+ */
+class FlightRecorder {
+
+    public:
+        /**
+         * Starts capturing records.
+         *
+         * @param num_records               records kept per thread
+         * @param record_size               bytes per record slot
+         * @param capture_level             lowest level captured
+         * @param install_signal_handlers   dump on SIGSEGV, SIGBUS, SIGFPE,
+         *                                  SIGILL and SIGABRT?
+         */
+        static void enable(std::size_t num_records=1024,
+                std::size_t record_size=256,
+                Logger::LoggingLevel capture_level=Logger::LoggingLevel::NOTSET,
+                bool install_signal_handlers=true) {
+            State & state = FlightRecorder::state_();
+            {
+                std::lock_guard<std::mutex> lock(state.mutex);
+                state.num_records = num_records;
+                state.record_size = record_size;
+                state.generation += 1;
+            }
+            Logger::set_capture_hook(&FlightRecorder::capture, capture_level);
+            console::AbortHook previous = console::set_abort_hook(&FlightRecorder::on_abort_);
+            if (previous != &FlightRecorder::on_abort_) {
+                FlightRecorder::previous_abort_hook_().store(previous);
+            }
+            if (install_signal_handlers) {
+                FlightRecorder::install_signal_handlers();
+            }
+        }
+
+        /**
+         * Stops capturing records, and hands the abort hook back to
+         * whichever one it replaced. Captured records are kept until the
+         * recorder is next enabled.
+         */
+        static void disable() {
+            Logger::set_capture_hook(nullptr, Logger::LoggingLevel::NOTSET);
+            console::AbortHook own = &FlightRecorder::on_abort_;
+            console::AbortHook previous = FlightRecorder::previous_abort_hook_().load();
+            if (console::abort_hook_().compare_exchange_strong(own, previous)) {
+                FlightRecorder::previous_abort_hook_().store(nullptr);
+            }
+        }
+
+        /**
+         * Stores a binary-encoded record in the calling thread's ring.
+         * Installed as the Logger capture hook. Records logged after the
+         * thread's handle to its ring has been destroyed (from a static
+         * destructor, during exit) are not captured.
+         *
+         * @param record    encoded record, including length prefix
+         * @param size      size of encoded record
+         */
+        static void capture(const char * record, std::size_t size) {
+            // trivially destructible, so still readable after the holder
+            // itself is destroyed
+            thread_local bool destroyed = false;
+            if (destroyed) {
+                return;
+            }
+            thread_local RingHolder holder(destroyed);
+            Ring * ring = holder.ring.get();
+            if (ring == nullptr || ring->generation != FlightRecorder::state_().generation.load(std::memory_order_relaxed)) {
+                holder.acquire();
+                ring = holder.ring.get();
+            }
+            std::uint64_t count = ring->count.load(std::memory_order_relaxed);
+            char * slot = &ring->data[(count % ring->num_records) * ring->slot_size];
+            std::uint32_t stored = static_cast<std::uint32_t>(std::min(size, ring->slot_size - sizeof(std::uint32_t)));
+            std::memcpy(slot, &stored, sizeof(stored));
+            std::memcpy(slot + sizeof(stored), record, stored);
+            ring->count.store(count + 1, std::memory_order_release);
+        }
+
+        /**
+         * Renders the captured records of all threads, oldest first, to a
+         * file descriptor.
+         *
+         * @param fd    destination
+         */
+        static void dump(int fd) {
+            std::string text = FlightRecorder::render();
+            stream::FdWriter::write_all(fd, text.data(), text.size());
+        }
+
+        /**
+         * Renders the captured records of all threads, oldest first, to a
+         * file.
+         *
+         * @param path  destination
+         */
+        static void dump(const std::string & path) {
+            int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            if (fd < 0) {
+                throw std::runtime_error(strerror(errno));
+            }
+            FlightRecorder::dump(fd);
+            ::close(fd);
+        }
+
+        static void dump_to_stderr() {
+            FlightRecorder::dump(STDERR_FILENO);
+        }
+
+        /**
+         * Returns the captured records of all threads as text, oldest
+         * first.
+         */
+        static std::string render() {
+            struct Entry {
+                std::int64_t    ticks;
+                std::string     text;
+            };
+            std::vector<Entry> entries;
+            State & state = FlightRecorder::state_();
+            logbinary::Decoder decoder;
+            decoder.load_registry();
+            std::lock_guard<std::mutex> lock(state.mutex);
+            for (auto & ring : state.rings) {
+                std::uint64_t count = ring->count.load(std::memory_order_acquire);
+                std::uint64_t first = count > ring->num_records ? count - ring->num_records : 0;
+                for (std::uint64_t i = first; i < count; ++i) {
+                    const char * slot = &ring->data[(i % ring->num_records) * ring->slot_size];
+                    std::uint32_t stored;
+                    std::memcpy(&stored, slot, sizeof(stored));
+                    const char * record = slot + sizeof(stored);
+                    if (stored < logbinary::RECORD_ARGS_OFFSET) {
+                        continue;
+                    }
+                    Entry entry;
+                    std::memcpy(&entry.ticks, record + logbinary::RECORD_FLAGS_OFFSET + 1, sizeof(entry.ticks));
+                    try {
+                        decoder.process(record + sizeof(std::uint32_t), stored - sizeof(std::uint32_t), entry.text);
+                    } catch (logbinary::DecodeError &) {
+                        continue;
+                    }
+                    entries.push_back(std::move(entry));
+                }
+            }
+            std::stable_sort(entries.begin(), entries.end(),
+                    [](const Entry & a, const Entry & b) { return a.ticks < b.ticks; });
+            std::string text = "--- flight recorder: " + std::to_string(entries.size()) + " most recent log records ---\n";
+            for (auto & entry : entries) {
+                text += entry.text;
+            }
+            text += "--- end of flight recorder ---\n";
+            return text;
+        }
+
+        /**
+         * Dumps the flight recorder on SIGSEGV, SIGBUS, SIGFPE, SIGILL and
+         * SIGABRT, then restores the disposition the signal had before and
+         * re-raises it, so that any handler installed earlier still runs.
+         * Dumping from a signal handler is not async-signal-safe, so this is
+         * strictly best-effort.
+         */
+        static void install_signal_handlers() {
+            for (std::size_t i = 0; i < NUM_FATAL_SIGNALS; ++i) {
+                struct sigaction action;
+                std::memset(&action, 0, sizeof(action));
+                action.sa_handler = &FlightRecorder::handle_fatal_signal_;
+                sigemptyset(&action.sa_mask);
+                action.sa_flags = SA_RESETHAND;
+                struct sigaction previous;
+                if (sigaction(FlightRecorder::fatal_signals_[i], &action, &previous) == 0
+                        && previous.sa_handler != &FlightRecorder::handle_fatal_signal_) {
+                    FlightRecorder::previous_actions_()[i] = previous;
+                }
+            }
+        }
+
+    private:
+
+        struct Ring {
+            Ring(std::size_t num_records, std::size_t slot_size, unsigned long generation)
+                : num_records(num_records)
+                , slot_size(slot_size)
+                , generation(generation)
+                , data(num_records * slot_size)
+                , count(0)
+                , in_use(true) {
+            }
+            const std::size_t           num_records;
+            const std::size_t           slot_size;
+            const unsigned long         generation;
+            std::vector<char>           data;
+            std::atomic<std::uint64_t>  count;
+            bool                        in_use;
+        };
+
+        struct State {
+            State()
+                : num_records(1024)
+                , record_size(256)
+                , generation(0) {
+            }
+            std::mutex                          mutex;
+            std::size_t                         num_records;
+            std::size_t                         record_size;
+            std::atomic<unsigned long>          generation;
+            std::vector<std::shared_ptr<Ring>>  rings;
+        };
+
+        /**
+         * Thread-local handle to a ring. Rings outlive their threads, so
+         * that a dump includes records from threads that have exited; an
+         * exited thread's ring is handed on to the next new thread.
+         */
+        struct RingHolder {
+            explicit RingHolder(bool & destroyed)
+                : destroyed(destroyed) {
+            }
+
+            ~RingHolder() {
+                this->destroyed = true;
+                if (this->ring) {
+                    std::lock_guard<std::mutex> lock(FlightRecorder::state_().mutex);
+                    this->ring->in_use = false;
+                }
+            }
+
+            void acquire() {
+                State & state = FlightRecorder::state_();
+                std::lock_guard<std::mutex> lock(state.mutex);
+                if (this->ring) {
+                    this->ring->in_use = false;
+                }
+                this->ring.reset();
+                for (auto & r : state.rings) {
+                    if (!r->in_use && r->generation == state.generation) {
+                        r->in_use = true;
+                        this->ring = r;
+                        return;
+                    }
+                }
+                // rings from an earlier configuration are discarded once
+                // their threads have moved on
+                state.rings.erase(std::remove_if(state.rings.begin(), state.rings.end(),
+                            [&state](const std::shared_ptr<Ring> & r) { return !r->in_use && r->generation != state.generation; }),
+                        state.rings.end());
+                std::size_t slot_size = std::max(state.record_size, logbinary::RECORD_ARGS_OFFSET + sizeof(std::uint32_t));
+                this->ring = std::make_shared<Ring>(std::max<std::size_t>(state.num_records, 1), slot_size, state.generation);
+                state.rings.push_back(this->ring);
+            }
+
+            std::shared_ptr<Ring>   ring;
+            bool &                  destroyed;
+        };
+
+        /**
+         * Never destroyed, since records may be captured (and rings
+         * released) from static destructors during exit.
+         */
+        static State & state_() {
+            static State * state = new State();
+            return *state;
+        }
+
+        static void handle_fatal_signal_(int sig) {
+            static std::atomic<bool> dumping(false);
+            if (!dumping.exchange(true)) {
+                FlightRecorder::dump_to_stderr();
+            }
+            for (std::size_t i = 0; i < NUM_FATAL_SIGNALS; ++i) {
+                if (FlightRecorder::fatal_signals_[i] == sig) {
+                    sigaction(sig, &FlightRecorder::previous_actions_()[i], nullptr);
+                }
+            }
+            ::raise(sig);
+        }
+
+        /**
+         * Dumps the flight recorder, then runs the abort hook it replaced,
+         * if any.
+         */
+        static void on_abort_() {
+            FlightRecorder::dump_to_stderr();
+            console::AbortHook previous = FlightRecorder::previous_abort_hook_().exchange(nullptr);
+            if (previous != nullptr) {
+                previous();
+            }
+        }
+
+        static std::atomic<console::AbortHook> & previous_abort_hook_() {
+            static std::atomic<console::AbortHook> hook(nullptr);
+            return hook;
+        }
+
+        /**
+         * Dispositions of the fatal signals before the handlers were
+         * installed (zero-initialized, i.e., SIG_DFL, until then).
+         */
+        static struct sigaction * previous_actions_() {
+            static struct sigaction actions[NUM_FATAL_SIGNALS];
+            return actions;
+        }
+
+    private:
+        static constexpr std::size_t NUM_FATAL_SIGNALS = 5;
+        static constexpr int fatal_signals_[NUM_FATAL_SIGNALS] = {SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT};
+
+}; // FlightRecorder
+
+} // namespace colugo
+
+#endif
@@ -0,0 +1,164 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright 2013 Jeet Sukumaran.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program. If not, see <http://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include <charconv>
+#include <cmath>
+#include <cstring>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <type_traits>
+#include "stream.hpp"
+
+#if !defined(COLUGO_JSON_HPP)
+#define COLUGO_JSON_HPP
+
+namespace colugo { namespace json {
+
+/**
+ * Appends characters to a string, escaped for use inside a JSON string
+ * literal. Makes a single pass over the source, copying runs of characters
+ * that need no escaping in bulk.
+ *
+ * @param out   destination
+ * @param s     source characters
+ * @param size  number of source characters
+ */
+inline void append_escaped(std::string & out, const char * s, std::size_t size) {
+    static const char hex_digits[] = "0123456789abcdef";
+    const char * run_start = s;
+    const char * end = s + size;
+    for (const char * p = s; p != end; ++p) {
+        unsigned char c = static_cast<unsigned char>(*p);
+        if (c >= 0x20 && c != '"' && c != '\\') {
+            continue;
+        }
+        out.append(run_start, p);
+        switch (c) {
+            case '"':  out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\t': out += "\\t"; break;
+            case '\b': out += "\\b"; break;
+            case '\f': out += "\\f"; break;
+            default: {
+                char u[6] = {'\\', 'u', '0', '0', hex_digits[c >> 4], hex_digits[c & 0xF]};
+                out.append(u, 6);
+            }
+        }
+        run_start = p + 1;
+    }
+    out.append(run_start, end);
+}
+
+/**
+ * Appends a quoted, escaped JSON string.
+ */
+inline void append_string(std::string & out, const char * s, std::size_t size) {
+    out += '"';
+    append_escaped(out, s, size);
+    out += '"';
+}
+
+/**
+ * Stream buffer that JSON-escapes everything written through it and
+ * appends the result to a caller-owned string, so that values rendered
+ * with ostream insertion operators can be placed inside a JSON string
+ * without an intermediate copy.
+ */
+class EscapingStreamBuf : public std::streambuf {
+
+    public:
+        explicit EscapingStreamBuf(std::string * dest=nullptr)
+            : dest_(dest) {
+        }
+
+        void set_destination(std::string * dest) {
+            this->dest_ = dest;
+        }
+
+    protected:
+        int_type overflow(int_type c) override {
+            if (!traits_type::eq_int_type(c, traits_type::eof())) {
+                char ch = traits_type::to_char_type(c);
+                append_escaped(*this->dest_, &ch, 1);
+            }
+            return traits_type::not_eof(c);
+        }
+
+        std::streamsize xsputn(const char * s, std::streamsize n) override {
+            append_escaped(*this->dest_, s, static_cast<std::size_t>(n));
+            return n;
+        }
+
+    private:
+        std::string *   dest_;
+
+}; // EscapingStreamBuf
+
+///////////////////////////////////////////////////////////////////////////////
+// Values
+
+template <typename T>
+inline void append_value(std::string & out, const T & value) {
+    if constexpr (std::is_same<T, bool>::value) {
+        out += value ? "true" : "false";
+    } else if constexpr (std::is_same<T, char>::value
+            || std::is_same<T, signed char>::value
+            || std::is_same<T, unsigned char>::value) {
+        // characters, as text channels render them
+        append_string(out, reinterpret_cast<const char *>(&value), 1);
+    } else if constexpr (std::is_integral<T>::value) {
+        char buffer[24];
+        auto result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+        out.append(buffer, result.ptr);
+    } else if constexpr (std::is_floating_point<T>::value) {
+        if (!std::isfinite(value)) {
+            out += "null";
+        } else {
+            char buffer[64];
+            auto result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+            out.append(buffer, result.ptr);
+        }
+    } else if constexpr (std::is_same<T, std::string>::value) {
+        append_string(out, value.data(), value.size());
+    } else if constexpr (std::is_convertible<const T &, const char *>::value) {
+        const char * s = value;
+        if (s == nullptr) {
+            out += "null";
+        } else {
+            append_string(out, s, std::strlen(s));
+        }
+    } else {
+        thread_local EscapingStreamBuf buf;
+        thread_local std::ostream os(&buf);
+        thread_local const std::ios default_format(nullptr);
+        buf.set_destination(&out);
+        os.copyfmt(default_format);
+        os.clear();
+        out += '"';
+        stream::write(os, value);
+        out += '"';
+    }
+}
+
+} } // colugo::json
+
+#endif
@@ -0,0 +1,545 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright 2013 Jeet Sukumaran.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program. If not, see <http://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include "stream.hpp"
+
+#if !defined(COLUGO_LOGBINARY_HPP)
+#define COLUGO_LOGBINARY_HPP
+
+namespace colugo { namespace logbinary {
+
+///////////////////////////////////////////////////////////////////////////////
+// Binary log format
+//
+// A binary log consists of a file header followed by length-prefixed
+// records, all in host byte order:
+//
+//      header:     8-byte magic, uint32 format version
+//      record:     uint32 length (of everything following), uint8 kind, ...
+//
+// Logger names ("sources"), call sites and compiled format strings
+// (COLUGO_FMT) are written once, as definition records, the first time a
+// channel sees them; log records then refer to them by id. Log record
+// arguments are stored as a one-byte type tag followed by the raw value
+// bytes (or a uint32 length and the characters, for strings), so no text
+// formatting takes place when logging. A stream::fmt() argument is stored
+// as its format id followed by its own arguments, so its literal text is
+// not repeated in each record; plain string arguments, including literals,
+// are copied into each record.
+//
+// Once an argument changes the formatting state of the stream a text
+// channel would write the record to (a manipulator such as std::hex or
+// std::setprecision()), the remaining arguments of the record are
+// rendered as text, as that channel would render them, and stored as
+// strings.
+//
+// A log file reopened for appending by a later process gets another header,
+// after which source and call site ids start afresh: decoders must discard
+// the definitions read so far when they meet one.
+
+const char FILE_MAGIC[8] = {'C', 'O', 'L', 'U', 'G', 'O', 'B', 'L'};
+const std::uint32_t FORMAT_VERSION = 2;
+
+enum RecordKind : std::uint8_t {
+    SOURCE_DEFINITION = 1,  // uint32 id, string name
+    SITE_DEFINITION = 2,    // uint32 id, uint32 line, string file, string function
+    LOG_RECORD = 3,         // uint8 level, uint8 flags, int64 ticks,
+                            // uint32 source id, uint32 site id, args...
+    FORMAT_DEFINITION = 4,  // uint32 id, uint32 number of pieces, strings
+                            // (the literal text around each placeholder)
+};
+
+enum RecordFlags : std::uint8_t {
+    SHOW_TIME = 0x01,
+    SHOW_LEVEL = 0x02,
+};
+
+enum ArgTag : std::uint8_t {
+    INT8 = 0x10, INT16 = 0x11, INT32 = 0x12, INT64 = 0x13,
+    UINT8 = 0x20, UINT16 = 0x21, UINT32 = 0x22, UINT64 = 0x23,
+    FLOAT = 0x30, DOUBLE = 0x31, LONG_DOUBLE = 0x32,
+    BOOL = 0x40,
+    CHAR = 0x41,
+    STRING = 0x50,
+    FIELD = 0x60,       // string key, followed by tagged value
+    FORMATTED = 0x70,   // uint32 format id, followed by one tagged value
+                        // per placeholder
+};
+
+/** Offset of the flags byte from the start of an encoded log record. */
+const std::size_t RECORD_FLAGS_OFFSET = sizeof(std::uint32_t) + 2;
+
+/** Offset of the first argument from the start of an encoded log record. */
+const std::size_t RECORD_ARGS_OFFSET = sizeof(std::uint32_t) + 2 + sizeof(std::int64_t) + 2 * sizeof(std::uint32_t);
+
+///////////////////////////////////////////////////////////////////////////////
+// Call sites and sources
+
+/**
+ * Static description of a logging statement. Instances are meant to be
+ * function-local statics (see COLUGO_LOG), so each is registered exactly
+ * once and lives for the duration of the program.
+ */
+struct CallSite {
+    CallSite(const char * file, unsigned line, const char * function);
+
+    /** The site used for records logged without call site information. */
+    static const CallSite & anonymous();
+
+    const char *    file;
+    unsigned        line;
+    const char *    function;
+    std::uint32_t   id;
+};
+
+/**
+ * Process-wide tables of log sources (logger names) and call sites. Ids are
+ * dense and never reused, so a channel can track which definitions it has
+ * already written with a single counter per table.
+ */
+class Registry {
+
+    public:
+        /**
+         * Returns the process-wide registry. Never destroyed, since loggers
+         * and call sites may be created during exit.
+         */
+        static Registry & get() {
+            static Registry * registry = new Registry();
+            return *registry;
+        }
+
+        std::uint32_t add_source(const std::string & name) {
+            std::lock_guard<std::mutex> lock(this->mutex_);
+            this->sources_.push_back(name);
+            return static_cast<std::uint32_t>(this->sources_.size() - 1);
+        }
+
+        std::uint32_t add_site(const CallSite * site) {
+            std::lock_guard<std::mutex> lock(this->mutex_);
+            this->sites_.push_back(site);
+            return static_cast<std::uint32_t>(this->sites_.size() - 1);
+        }
+
+        std::uint32_t num_sources() {
+            std::lock_guard<std::mutex> lock(this->mutex_);
+            return static_cast<std::uint32_t>(this->sources_.size());
+        }
+
+        std::uint32_t num_sites() {
+            std::lock_guard<std::mutex> lock(this->mutex_);
+            return static_cast<std::uint32_t>(this->sites_.size());
+        }
+
+        /**
+         * Returns the id of a compiled format string, assigning one (and
+         * recording its literal pieces) the first time it is seen.
+         *
+         * @param format    format string
+         * @param slot      storage for its id
+         * @return          id of format
+         */
+        template <std::size_t N>
+        std::uint32_t format_id(const stream::FormatString<N> & format, stream::FormatSlot & slot) {
+            std::uint32_t id = slot.id.load(std::memory_order_acquire);
+            if (id != 0) {
+                return id;
+            }
+            std::vector<std::string> pieces;
+            for (std::size_t i = 0; i <= format.num_fields(); ++i) {
+                pieces.emplace_back(format.piece(i));
+            }
+            std::lock_guard<std::mutex> lock(this->mutex_);
+            id = slot.id.load(std::memory_order_relaxed);
+            if (id == 0) {
+                id = static_cast<std::uint32_t>(this->formats_.size());
+                this->formats_.push_back(std::move(pieces));
+                this->num_formats_.store(id + 1, std::memory_order_release);
+                slot.id.store(id, std::memory_order_release);
+            }
+            return id;
+        }
+
+        /**
+         * Number of format ids assigned (including the reserved id 0). Read
+         * without locking, so that channels can cheaply check for formats
+         * they have not yet defined.
+         */
+        std::uint32_t num_formats() const {
+            return this->num_formats_.load(std::memory_order_acquire);
+        }
+
+        std::string source_name(std::uint32_t id) {
+            std::lock_guard<std::mutex> lock(this->mutex_);
+            return this->sources_[id];
+        }
+
+        const CallSite * site(std::uint32_t id) {
+            std::lock_guard<std::mutex> lock(this->mutex_);
+            return this->sites_[id];
+        }
+
+        std::vector<std::string> format_pieces(std::uint32_t id) {
+            std::lock_guard<std::mutex> lock(this->mutex_);
+            return this->formats_[id];
+        }
+
+    private:
+        Registry()
+            : num_formats_(1) {
+            // id 0 is reserved for the anonymous call site, and as the
+            // "unassigned" format id
+            this->sites_.push_back(nullptr);
+            this->formats_.emplace_back();
+        }
+
+    private:
+        std::mutex                              mutex_;
+        std::vector<std::string>                sources_;
+        std::vector<const CallSite *>           sites_;
+        std::vector<std::vector<std::string>>   formats_;
+        std::atomic<std::uint32_t>              num_formats_;
+
+}; // Registry
+
+inline CallSite::CallSite(const char * file, unsigned line, const char * function)
+    : file(file)
+    , line(line)
+    , function(function)
+    , id(file == nullptr ? 0 : Registry::get().add_site(this)) {
+}
+
+inline const CallSite & CallSite::anonymous() {
+    static const CallSite site(nullptr, 0, nullptr);
+    return site;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Encoding primitives
+
+inline void put_bytes(std::string & out, const void * data, std::size_t size) {
+    out.append(static_cast<const char *>(data), size);
+}
+
+template <typename T>
+inline void put(std::string & out, T value) {
+    put_bytes(out, &value, sizeof(value));
+}
+
+inline void put_string(std::string & out, const char * s, std::size_t size) {
+    put<std::uint32_t>(out, static_cast<std::uint32_t>(size));
+    put_bytes(out, s, size);
+}
+
+inline std::size_t begin_record(std::string & out, RecordKind kind) {
+    std::size_t start = out.size();
+    put<std::uint32_t>(out, 0);
+    put<std::uint8_t>(out, kind);
+    return start;
+}
+
+inline void end_record(std::string & out, std::size_t start) {
+    std::uint32_t size = static_cast<std::uint32_t>(out.size() - start - sizeof(std::uint32_t));
+    std::memcpy(&out[start], &size, sizeof(size));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Argument encoding
+
+/**
+ * The stream that the arguments of one record are rendered through when
+ * they cannot be stored raw, set up on first use. Its formatting state
+ * carries over from one argument to the next, as it would on a text
+ * channel; once an argument changes it, the remaining arguments are all
+ * rendered (see encode_args()).
+ */
+class ArgRenderer {
+
+    public:
+        ArgRenderer()
+            : previous_(ArgRenderer::current_())
+            , formatting_(false) {
+            ArgRenderer::current_() = this;
+        }
+
+        ~ArgRenderer() {
+            ArgRenderer::current_() = this->previous_;
+        }
+
+        ArgRenderer(const ArgRenderer &) = delete;
+        ArgRenderer & operator=(const ArgRenderer &) = delete;
+
+        /**
+         * Returns the renderer of the record being encoded on this thread,
+         * if any.
+         */
+        static ArgRenderer * current() {
+            return ArgRenderer::current_();
+        }
+
+        /** Encodes one argument, raw if possible. */
+        template <typename T>
+        void encode(std::string & out, const T & arg);
+
+        /** Renders one argument as text and stores it as a string. */
+        template <typename T>
+        void encode_rendered(std::string & out, const T & arg) {
+            if (!this->out_) {
+                this->out_.emplace(&this->buf_);
+            }
+            put<std::uint8_t>(out, STRING);
+            std::size_t size_pos = out.size();
+            put<std::uint32_t>(out, 0);
+            this->buf_.set_destination(&out);
+            this->out_->clear();
+            stream::write(*this->out_, arg);
+            std::uint32_t size = static_cast<std::uint32_t>(out.size() - size_pos - sizeof(std::uint32_t));
+            std::memcpy(&out[size_pos], &size, sizeof(size));
+            if (!stream::Buffer::has_default_format(*this->out_)) {
+                this->formatting_ = true;
+            }
+        }
+
+    private:
+        static ArgRenderer *& current_() {
+            thread_local ArgRenderer * renderer = nullptr;
+            return renderer;
+        }
+
+    private:
+        ArgRenderer *                   previous_;
+        bool                            formatting_;
+        stream::StringAppendBuf         buf_;
+        std::optional<std::ostream>     out_;
+
+}; // ArgRenderer
+
+/**
+ * Encodes one argument through the renderer of the record being encoded,
+ * or on its own if there is none.
+ */
+template <typename T>
+inline void encode_arg(std::string & out, const T & arg) {
+    ArgRenderer * renderer = ArgRenderer::current();
+    if (renderer != nullptr) {
+        renderer->encode(out, arg);
+    } else {
+        ArgRenderer own;
+        own.encode(out, arg);
+    }
+}
+
+template <typename T, typename Enable=void>
+struct ArgEncoder {
+    // Anything else is rendered to text exactly as a text channel would
+    // render it, and stored as a string.
+    static void encode(std::string & out, const T & arg) {
+        ArgRenderer * renderer = ArgRenderer::current();
+        if (renderer != nullptr) {
+            renderer->encode_rendered(out, arg);
+        } else {
+            ArgRenderer own;
+            own.encode_rendered(out, arg);
+        }
+    }
+};
+
+template <typename T>
+inline void ArgRenderer::encode(std::string & out, const T & arg) {
+    if (this->formatting_) {
+        this->encode_rendered(out, arg);
+    } else {
+        ArgEncoder<T>::encode(out, arg);
+    }
+}
+
+template <typename T>
+struct ArgEncoder<T, typename std::enable_if<std::is_integral<T>::value
+        && !std::is_same<T, bool>::value
+        && !std::is_same<T, char>::value
+        && !std::is_same<T, signed char>::value
+        && !std::is_same<T, unsigned char>::value>::type> {
+    static void encode(std::string & out, const T & arg) {
+        std::uint8_t tag = std::is_signed<T>::value ? INT8 : UINT8;
+        switch (sizeof(T)) {
+            case 1: break;
+            case 2: tag += 1; break;
+            case 4: tag += 2; break;
+            default: tag += 3; break;
+        }
+        put<std::uint8_t>(out, tag);
+        put<T>(out, arg);
+    }
+};
+
+template <typename T>
+struct ArgEncoder<T, typename std::enable_if<std::is_same<T, char>::value
+        || std::is_same<T, signed char>::value
+        || std::is_same<T, unsigned char>::value>::type> {
+    static void encode(std::string & out, const T & arg) {
+        put<std::uint8_t>(out, CHAR);
+        put<char>(out, static_cast<char>(arg));
+    }
+};
+
+template <>
+struct ArgEncoder<bool> {
+    static void encode(std::string & out, const bool & arg) {
+        put<std::uint8_t>(out, BOOL);
+        put<std::uint8_t>(out, arg ? 1 : 0);
+    }
+};
+
+template <>
+struct ArgEncoder<float> {
+    static void encode(std::string & out, const float & arg) {
+        put<std::uint8_t>(out, FLOAT);
+        put<float>(out, arg);
+    }
+};
+
+template <>
+struct ArgEncoder<double> {
+    static void encode(std::string & out, const double & arg) {
+        put<std::uint8_t>(out, DOUBLE);
+        put<double>(out, arg);
+    }
+};
+
+template <>
+struct ArgEncoder<long double> {
+    static void encode(std::string & out, const long double & arg) {
+        put<std::uint8_t>(out, LONG_DOUBLE);
+        put<long double>(out, arg);
+    }
+};
+
+template <>
+struct ArgEncoder<std::string> {
+    static void encode(std::string & out, const std::string & arg) {
+        put<std::uint8_t>(out, STRING);
+        put_string(out, arg.data(), arg.size());
+    }
+};
+
+template <>
+struct ArgEncoder<const char *> {
+    static void encode(std::string & out, const char * arg) {
+        put<std::uint8_t>(out, STRING);
+        put_string(out, arg, arg == nullptr ? 0 : std::strlen(arg));
+    }
+};
+
+template <>
+struct ArgEncoder<char *> : public ArgEncoder<const char *> {
+};
+
+template <std::size_t N>
+struct ArgEncoder<char[N]> : public ArgEncoder<const char *> {
+};
+
+template <std::size_t N, typename... Types>
+struct ArgEncoder<stream::Formatted<N, Types...>> {
+    static void encode(std::string & out, const stream::Formatted<N, Types...> & arg) {
+        put<std::uint8_t>(out, FORMATTED);
+        put<std::uint32_t>(out, Registry::get().format_id(arg.format, arg.slot));
+        std::apply([&out](const Types&... values) { (encode_arg(out, values), ...); }, arg.args);
+    }
+};
+
+/**
+ * Encodes the arguments of a record.
+ */
+template <typename... Types>
+inline void encode_args(std::string & out, const Types&... args) {
+    ArgRenderer renderer;
+    (renderer.encode(out, args), ...);
+    (void)out;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Record encoding
+
+inline void encode_file_header(std::string & out) {
+    put_bytes(out, FILE_MAGIC, sizeof(FILE_MAGIC));
+    put<std::uint32_t>(out, FORMAT_VERSION);
+}
+
+inline void encode_source_definition(std::string & out, std::uint32_t id, const std::string & name) {
+    std::size_t start = begin_record(out, SOURCE_DEFINITION);
+    put<std::uint32_t>(out, id);
+    put_string(out, name.data(), name.size());
+    end_record(out, start);
+}
+
+inline void encode_format_definition(std::string & out, std::uint32_t id, const std::vector<std::string> & pieces) {
+    std::size_t start = begin_record(out, FORMAT_DEFINITION);
+    put<std::uint32_t>(out, id);
+    put<std::uint32_t>(out, static_cast<std::uint32_t>(pieces.size()));
+    for (const std::string & piece : pieces) {
+        put_string(out, piece.data(), piece.size());
+    }
+    end_record(out, start);
+}
+
+inline void encode_site_definition(std::string & out, std::uint32_t id, const CallSite * site) {
+    std::size_t start = begin_record(out, SITE_DEFINITION);
+    put<std::uint32_t>(out, id);
+    if (site == nullptr) {
+        put<std::uint32_t>(out, 0);
+        put_string(out, "", 0);
+        put_string(out, "", 0);
+    } else {
+        put<std::uint32_t>(out, site->line);
+        put_string(out, site->file, std::strlen(site->file));
+        put_string(out, site->function, std::strlen(site->function));
+    }
+    end_record(out, start);
+}
+
+template <typename... Types>
+inline void encode_log_record(std::string & out,
+        std::uint8_t level,
+        std::uint8_t flags,
+        std::int64_t ticks,
+        std::uint32_t source_id,
+        std::uint32_t site_id,
+        const Types&... args) {
+    std::size_t start = begin_record(out, LOG_RECORD);
+    put<std::uint8_t>(out, level);
+    put<std::uint8_t>(out, flags);
+    put<std::int64_t>(out, ticks);
+    put<std::uint32_t>(out, source_id);
+    put<std::uint32_t>(out, site_id);
+    encode_args(out, args...);
+    end_record(out, start);
+}
+
+} } // colugo::logbinary
+
+#endif
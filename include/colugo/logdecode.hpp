@@ -0,0 +1,335 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright 2013 Jeet Sukumaran.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program. If not, see <http://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <istream>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "logbinary.hpp"
+#include "logger.hpp"
+
+#if !defined(COLUGO_LOGDECODE_HPP)
+#define COLUGO_LOGDECODE_HPP
+
+namespace colugo { namespace logbinary {
+
+/**
+ * Thrown when binary log data is malformed.
+ */
+class DecodeError : public std::runtime_error {
+    public:
+        DecodeError(const char * msg) : std::runtime_error(msg) {}
+};
+
+/**
+ * Renders binary log records back to the text layout produced by text
+ * channels:
+ *
+ *      [name] - YYYY-mm-dd HH:MM:SS - LEVEL - message
+ */
+class Decoder {
+
+    public:
+        Decoder() {}
+
+        /**
+         * Reads and validates the file header.
+         *
+         * @param in    input stream positioned at start of binary log
+         */
+        void read_header(std::istream & in) {
+            char magic[sizeof(FILE_MAGIC)];
+            std::uint32_t version = 0;
+            in.read(magic, sizeof(magic));
+            in.read(reinterpret_cast<char *>(&version), sizeof(version));
+            if (!in || std::memcmp(magic, FILE_MAGIC, sizeof(magic)) != 0) {
+                throw DecodeError("not a colugo binary log");
+            }
+            if (version == 0 || version > FORMAT_VERSION) {
+                throw DecodeError("unsupported binary log format version");
+            }
+        }
+
+        /**
+         * Decodes all records in a binary log, writing the text rendering of
+         * each log record to <code>out</code>. A file header found between
+         * records (as written when a later process appends to the same
+         * file) starts a new set of source and call site definitions. A
+         * zero length word marks the end of the data: the NUL padding of a
+         * memory-mapped segment that was not trimmed (see MmapLogSink),
+         * e.g., after a crash.
+         *
+         * @param in    input stream positioned at start of binary log
+         * @param out   destination for rendered records
+         */
+        void decode(std::istream & in, std::ostream & out) {
+            this->read_header(in);
+            std::string record;
+            std::string text;
+            std::uint32_t size = 0;
+            while (in.read(reinterpret_cast<char *>(&size), sizeof(size))) {
+                if (size == 0) {
+                    break;
+                }
+                if (std::memcmp(&size, FILE_MAGIC, sizeof(size)) == 0) {
+                    this->read_repeated_header_(in);
+                    continue;
+                }
+                record.resize(size);
+                if (!in.read(&record[0], size)) {
+                    throw DecodeError("truncated record");
+                }
+                text.clear();
+                if (this->process(record.data(), record.size(), text)) {
+                    out.write(text.data(), static_cast<std::streamsize>(text.size()));
+                }
+            }
+        }
+
+        /**
+         * Processes a single record (excluding its length prefix).
+         * Definition records update the decoder tables; log records are
+         * rendered and appended to <code>text</code>.
+         *
+         * @param data  record bytes, starting with the record kind
+         * @param size  number of bytes in record
+         * @param text  destination for rendered text
+         * @return      <code>true</code> if a log record was rendered
+         */
+        bool process(const char * data, std::size_t size, std::string & text) {
+            Reader reader(data, size);
+            std::uint8_t kind = reader.get<std::uint8_t>();
+            if (kind == SOURCE_DEFINITION) {
+                std::uint32_t id = reader.get<std::uint32_t>();
+                this->ensure_size_(this->sources_, id);
+                this->sources_[id] = reader.get_string();
+                return false;
+            } else if (kind == SITE_DEFINITION) {
+                std::uint32_t id = reader.get<std::uint32_t>();
+                this->ensure_size_(this->sites_, id);
+                Site & site = this->sites_[id];
+                site.line = reader.get<std::uint32_t>();
+                site.file = reader.get_string();
+                site.function = reader.get_string();
+                return false;
+            } else if (kind == FORMAT_DEFINITION) {
+                std::uint32_t id = reader.get<std::uint32_t>();
+                this->ensure_size_(this->formats_, id);
+                std::vector<std::string> & pieces = this->formats_[id];
+                pieces.resize(reader.get<std::uint32_t>());
+                for (std::string & piece : pieces) {
+                    piece = reader.get_string();
+                }
+                return false;
+            } else if (kind == LOG_RECORD) {
+                this->render_(reader, text);
+                return true;
+            }
+            throw DecodeError("unknown record kind");
+        }
+
+        /**
+         * Loads source, call site and format string definitions directly
+         * from the in-process registry, for decoding records that were
+         * captured without their definitions.
+         */
+        void load_registry() {
+            auto & registry = Registry::get();
+            std::uint32_t num_sources = registry.num_sources();
+            this->sources_.resize(num_sources);
+            for (std::uint32_t id = 0; id < num_sources; ++id) {
+                this->sources_[id] = registry.source_name(id);
+            }
+            std::uint32_t num_sites = registry.num_sites();
+            this->sites_.resize(num_sites);
+            for (std::uint32_t id = 1; id < num_sites; ++id) {
+                const CallSite * cs = registry.site(id);
+                this->sites_[id].line = cs->line;
+                this->sites_[id].file = cs->file;
+                this->sites_[id].function = cs->function;
+            }
+            std::uint32_t num_formats = registry.num_formats();
+            this->formats_.resize(num_formats);
+            for (std::uint32_t id = 1; id < num_formats; ++id) {
+                this->formats_[id] = registry.format_pieces(id);
+            }
+        }
+
+    private:
+
+        /**
+         * Reads the rest of a file header whose first four bytes have
+         * already been consumed, and drops all definitions.
+         */
+        void read_repeated_header_(std::istream & in) {
+            char magic[sizeof(FILE_MAGIC) - sizeof(std::uint32_t)];
+            std::uint32_t version = 0;
+            in.read(magic, sizeof(magic));
+            in.read(reinterpret_cast<char *>(&version), sizeof(version));
+            if (!in || std::memcmp(magic, FILE_MAGIC + sizeof(std::uint32_t), sizeof(magic)) != 0) {
+                throw DecodeError("truncated record");
+            }
+            if (version == 0 || version > FORMAT_VERSION) {
+                throw DecodeError("unsupported binary log format version");
+            }
+            this->sources_.clear();
+            this->sites_.clear();
+            this->formats_.clear();
+        }
+
+        struct Site {
+            unsigned        line;
+            std::string     file;
+            std::string     function;
+        };
+
+        class Reader {
+            public:
+                Reader(const char * data, std::size_t size)
+                    : pos_(data)
+                    , end_(data + size) {
+                }
+                template <typename T>
+                T get() {
+                    T value;
+                    this->check_(sizeof(T));
+                    std::memcpy(&value, this->pos_, sizeof(T));
+                    this->pos_ += sizeof(T);
+                    return value;
+                }
+                std::string get_string() {
+                    std::uint32_t size = this->get<std::uint32_t>();
+                    this->check_(size);
+                    std::string s(this->pos_, size);
+                    this->pos_ += size;
+                    return s;
+                }
+                bool at_end() const {
+                    return this->pos_ >= this->end_;
+                }
+            private:
+                void check_(std::size_t size) {
+                    if (static_cast<std::size_t>(this->end_ - this->pos_) < size) {
+                        throw DecodeError("truncated record");
+                    }
+                }
+            private:
+                const char *    pos_;
+                const char *    end_;
+        };
+
+        template <typename T>
+        void ensure_size_(std::vector<T> & v, std::uint32_t id) {
+            if (v.size() <= id) {
+                v.resize(id + 1);
+            }
+        }
+
+        void render_(Reader & reader, std::string & text) {
+            std::uint8_t level = reader.get<std::uint8_t>();
+            std::uint8_t flags = reader.get<std::uint8_t>();
+            std::int64_t ticks = reader.get<std::int64_t>();
+            std::uint32_t source_id = reader.get<std::uint32_t>();
+            reader.get<std::uint32_t>(); // call site id
+            text += '[';
+            if (source_id < this->sources_.size()) {
+                text += this->sources_[source_id];
+            }
+            text += ']';
+            if (flags & SHOW_TIME) {
+                std::time_t t = static_cast<std::time_t>(ticks / 1000000000);
+                std::tm local_tm;
+                char tbuffer[20];
+                localtime_r(&t, &local_tm);
+                std::strftime(tbuffer, 20, "%Y-%m-%d %H:%M:%S", &local_tm);
+                text += " - ";
+                text += tbuffer;
+            }
+            if (flags & SHOW_LEVEL) {
+                text += " - ";
+                text += Logger::level_name(static_cast<Logger::LoggingLevel>(level));
+            }
+            text += " - ";
+            stream::StringAppendBuf buf(&text);
+            std::ostream out(&buf);
+            try {
+                while (!reader.at_end()) {
+                    this->render_arg_(reader, out);
+                }
+            } catch (DecodeError &) {
+                // record was truncated (e.g., captured into a fixed-size
+                // slot): keep what could be rendered
+                out << " ...";
+            }
+            text += '\n';
+        }
+
+        void render_arg_(Reader & reader, std::ostream & out) {
+            std::uint8_t tag = reader.get<std::uint8_t>();
+            switch (tag) {
+                case INT8:          out << reader.get<std::int8_t>() + 0; break;
+                case INT16:         out << reader.get<std::int16_t>(); break;
+                case INT32:         out << reader.get<std::int32_t>(); break;
+                case INT64:         out << reader.get<std::int64_t>(); break;
+                case UINT8:         out << reader.get<std::uint8_t>() + 0u; break;
+                case UINT16:        out << reader.get<std::uint16_t>(); break;
+                case UINT32:        out << reader.get<std::uint32_t>(); break;
+                case UINT64:        out << reader.get<std::uint64_t>(); break;
+                case FLOAT:         out << reader.get<float>(); break;
+                case DOUBLE:        out << reader.get<double>(); break;
+                case LONG_DOUBLE:   out << reader.get<long double>(); break;
+                case BOOL:          out << (reader.get<std::uint8_t>() != 0); break;
+                case CHAR:          out << reader.get<char>(); break;
+                case STRING:        out << reader.get_string(); break;
+                case FIELD:
+                    out << ' ' << reader.get_string() << '=';
+                    this->render_arg_(reader, out);
+                    break;
+                case FORMATTED: {
+                    std::uint32_t id = reader.get<std::uint32_t>();
+                    if (id >= this->formats_.size() || this->formats_[id].empty()) {
+                        throw DecodeError("undefined format string");
+                    }
+                    const std::vector<std::string> & pieces = this->formats_[id];
+                    for (std::size_t i = 0; i + 1 < pieces.size(); ++i) {
+                        out << pieces[i];
+                        this->render_arg_(reader, out);
+                    }
+                    out << pieces.back();
+                    break;
+                }
+                default:
+                    throw DecodeError("unknown argument type");
+            }
+        }
+
+    private:
+        std::vector<std::string>                sources_;
+        std::vector<Site>                       sites_;
+        std::vector<std::vector<std::string>>   formats_;
+
+}; // Decoder
+
+} } // colugo::logbinary
+
+#endif
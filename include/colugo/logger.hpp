@@ -17,19 +17,515 @@
 //
 ///////////////////////////////////////////////////////////////////////////////
 
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cstdlib>
 #include <map>
 #include <iostream>
 #include <string>
 #include <vector>
 #include <ctime>
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <stdexcept>
+#include <type_traits>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
 #include "stream.hpp"
 #include "textutil.hpp"
+#include "console.hpp"
+#include "logbinary.hpp"
+#include "json.hpp"
 
 #if !defined(COLUGO_LOGGER_HPP)
 #define COLUGO_LOGGER_HPP
 
 namespace colugo {
 
+///////////////////////////////////////////////////////////////////////////////
+// Log sinks
+
+/**
+ * Destination of formatted log records.
+ *
+ * Each call to append() receives exactly one complete record (including the
+ * trailing newline) and must deliver it as a single unit, so that records
+ * written concurrently from different threads never interleave.
+ */
+class LogSink {
+
+    public:
+        virtual ~LogSink() {}
+
+        /**
+         * Writes out one complete record.
+         *
+         * @param data  record bytes
+         * @param size  number of bytes in record
+         */
+        virtual void append(const char * data, std::size_t size) = 0;
+
+        /**
+         * Writes out one complete log record of a known level. Sinks that
+         * treat records differently by level override this; by default it
+         * just calls append().
+         *
+         * @param level     logging level (as Logger::LoggingLevel)
+         * @param data      record bytes
+         * @param size      number of bytes in record
+         */
+        virtual void append_at_level(int level, const char * data, std::size_t size) {
+            (void)level;
+            this->append(data, size);
+        }
+
+        /**
+         * Function encoding the bytes that must begin every file a sink
+         * writes to (see set_preamble()).
+         */
+        typedef void (*PreambleWriter)(std::string & out);
+
+        /**
+         * Sets the bytes written at the start of each new file the sink
+         * opens from now on (e.g., on rolling over to a new file), ahead of
+         * any record. Binary channels use this to repeat the file header and
+         * definitions, without which the new file could not be decoded.
+         * Sinks that only ever write to one destination ignore it.
+         *
+         * @param writer    function encoding the preamble
+         */
+        virtual void set_preamble(PreambleWriter writer) {
+            (void)writer;
+        }
+
+}; // LogSink
+
+/**
+ * Sink writing to a std::ostream.
+ *
+ * The stream is written and flushed inside a short critical section.
+ * Since a stream is often shared by several loggers (e.g., std::cerr), use
+ * StreamLogSink::get() to obtain the single sink instance (and hence the
+ * single lock) associated with a particular stream.
+ */
+class StreamLogSink : public LogSink {
+
+    public:
+        StreamLogSink(std::ostream & dest)
+            : dest_(dest) {
+        }
+
+        void append(const char * data, std::size_t size) override {
+            std::lock_guard<std::mutex> lock(this->mutex_);
+            this->dest_.write(data, static_cast<std::streamsize>(size));
+            this->dest_.flush();
+        }
+
+        /**
+         * Returns the sink shared by all loggers writing to the given stream.
+         *
+         * @param dest  output stream
+         * @return      sink for <code>dest</code>
+         */
+        static std::shared_ptr<StreamLogSink> get(std::ostream & dest) {
+            // never destroyed, so that sinks can be obtained during exit
+            static std::mutex * registry_mutex = new std::mutex();
+            static auto * registry = new std::map<std::ostream *, std::weak_ptr<StreamLogSink>>();
+            std::lock_guard<std::mutex> lock(*registry_mutex);
+            auto & entry = (*registry)[&dest];
+            auto sink = entry.lock();
+            if (!sink) {
+                sink = std::make_shared<StreamLogSink>(dest);
+                entry = sink;
+            }
+            return sink;
+        }
+
+    private:
+        std::ostream &  dest_;
+        std::mutex      mutex_;
+
+}; // StreamLogSink
+
+/**
+ * Sink writing directly to a file descriptor.
+ *
+ * Each record is submitted with a single write(2) call, which the kernel
+ * applies atomically to files opened with O_APPEND, so no user-space lock
+ * is taken.
+ */
+class FdLogSink : public LogSink {
+
+    public:
+        /**
+         * Wraps an existing file descriptor.
+         *
+         * @param fd        file descriptor to write to
+         * @param owns_fd   if <code>true</code>, descriptor is closed on
+         *                  destruction
+         */
+        FdLogSink(int fd, bool owns_fd=false)
+            : fd_(fd)
+            , owns_fd_(owns_fd) {
+        }
+
+        ~FdLogSink() {
+            if (this->owns_fd_ && this->fd_ >= 0) {
+                ::close(this->fd_);
+            }
+        }
+
+        FdLogSink(const FdLogSink &) = delete;
+        FdLogSink & operator=(const FdLogSink &) = delete;
+
+        void append(const char * data, std::size_t size) override {
+            stream::FdWriter::write_all(this->fd_, data, size);
+        }
+
+        /**
+         * Opens (creating if necessary) a file for appending.
+         *
+         * @param path  path to log file
+         * @return      sink owning the opened file descriptor
+         */
+        static std::shared_ptr<FdLogSink> open(const std::string & path) {
+            int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+            if (fd < 0) {
+                throw std::runtime_error(strerror(errno));
+            }
+            return std::make_shared<FdLogSink>(fd, true);
+        }
+
+    private:
+        int     fd_;
+        bool    owns_fd_;
+
+}; // FdLogSink
+
+///////////////////////////////////////////////////////////////////////////////
+// Structured fields
+
+/**
+ * A named value attached to a log record (see kv()). Text channels render
+ * it as " key=value" following the message; JSON channels render it as a
+ * member of the record object.
+ */
+template <typename T>
+struct LogField {
+    const char *    key;
+    const T &       value;
+};
+
+/**
+ * Creates a structured log field, e.g.:
+ *
+ *      log.info("loaded table", colugo::kv("rows", n), colugo::kv("ms", t));
+ *
+ * The field refers to <code>value</code> rather than copying it, so it
+ * must be used within the same full expression.
+ *
+ * @param key       field name
+ * @param value     field value
+ * @return          field
+ */
+template <typename T>
+inline LogField<T> kv(const char * key, const T & value) {
+    return LogField<T>{key, value};
+}
+
+template <typename T>
+inline std::ostream & operator<<(std::ostream & out, const LogField<T> & field) {
+    out << ' ' << field.key << '=';
+    stream::write(out, field.value);
+    return out;
+}
+
+template <typename T>
+struct is_log_field : public std::false_type {
+};
+
+template <typename T>
+struct is_log_field<LogField<T>> : public std::true_type {
+};
+
+namespace logbinary {
+
+template <typename T>
+struct ArgEncoder<LogField<T>> {
+    static void encode(std::string & out, const LogField<T> & field) {
+        put<std::uint8_t>(out, FIELD);
+        put_string(out, field.key, std::strlen(field.key));
+        ArgEncoder<T>::encode(out, field.value);
+    }
+};
+
+} // namespace logbinary
+
+///////////////////////////////////////////////////////////////////////////////
+// Lazy arguments
+
+/**
+ * A log record argument that is computed only if the record is actually
+ * written to a channel (see lazy()). The value is computed at most once,
+ * however many channels the record goes to.
+ */
+template <typename F>
+class LazyArg {
+
+    public:
+        typedef typename std::decay<typename std::invoke_result<const F &>::type>::type value_type;
+
+        explicit LazyArg(const F & func)
+            : func_(func) {
+        }
+
+        const value_type & get() const {
+            if (!this->value_) {
+                this->value_.emplace(this->func_());
+            }
+            return *this->value_;
+        }
+
+    private:
+        const F &                           func_;
+        mutable std::optional<value_type>   value_;
+
+}; // LazyArg
+
+/**
+ * Defers computing a log record argument until the record is known to be
+ * written, e.g.:
+ *
+ *      log.debug("tree: ", colugo::lazy([&] { return tree.to_newick(); }));
+ *
+ * or, for a field value, <code>kv("tree", lazy(...))</code>. Other
+ * function objects are logged as they are, never invoked. Records captured
+ * by the flight recorder but not written to any channel show the argument
+ * as "&lt;unevaluated&gt;".
+ *
+ * @param func  function object taking no arguments
+ * @return      deferred argument
+ */
+template <typename F>
+inline LazyArg<F> lazy(const F & func) {
+    return LazyArg<F>(func);
+}
+
+template <typename F>
+inline std::ostream & operator<<(std::ostream & out, const LazyArg<F> & arg) {
+    stream::write(out, arg.get());
+    return out;
+}
+
+template <typename T>
+struct is_lazy_arg : public std::false_type {
+};
+
+template <typename F>
+struct is_lazy_arg<LazyArg<F>> : public std::true_type {
+};
+
+namespace logbinary {
+
+template <typename F>
+struct ArgEncoder<LazyArg<F>> {
+    static void encode(std::string & out, const LazyArg<F> & arg) {
+        ArgEncoder<typename LazyArg<F>::value_type>::encode(out, arg.get());
+    }
+};
+
+} // namespace logbinary
+
+///////////////////////////////////////////////////////////////////////////////
+// LogThrottle
+
+/**
+ * Per-call-site rate limit and duplicate suppression state. Meant to be a
+ * function-local static at the logging statement (see
+ * COLUGO_LOG_THROTTLED).
+ *
+ * The rate limit is a token bucket, implemented as a generic cell rate
+ * algorithm over a single atomic "theoretical arrival time", so admitting
+ * or rejecting a record takes a coarse clock read and one or two atomic
+ * operations, with no locks. Records dropped by the limit are counted.
+ *
+ * Consecutive admitted records with identical arguments are collapsed into
+ * a "last message repeated N times" note. Both notes are emitted when a
+ * different message is next admitted at the same site, when a repeat or
+ * dropped record arrives more than the report interval after the first
+ * one unreported, or when the throttle or the logger is destroyed,
+ * whichever comes first.
+ */
+class Logger;
+
+class LogThrottle {
+
+    public:
+        /**
+         * @param rate                  sustained records per second
+         *                              (0 = no rate limit)
+         * @param burst                 records that may be admitted at once
+         * @param collapse_duplicates   collapse consecutive identical
+         *                              records?
+         * @param repeat_report_seconds longest time collapsed repeats go
+         *                              unreported while they keep arriving
+         */
+        LogThrottle(double rate,
+                unsigned burst=1,
+                bool collapse_duplicates=true,
+                unsigned long repeat_report_seconds=10)
+            : interval_ns_(rate > 0 ? static_cast<std::int64_t>(1.0e9 / rate) : 0)
+            , tolerance_ns_(rate > 0 ? static_cast<std::int64_t>(1.0e9 / rate) * static_cast<std::int64_t>(burst > 0 ? burst - 1 : 0) : 0)
+            , collapse_duplicates_(collapse_duplicates)
+            , repeat_report_ns_(static_cast<std::int64_t>(repeat_report_seconds) * 1000000000)
+            , theoretical_arrival_ns_(0)
+            , num_dropped_(0)
+            , last_hash_(0)
+            , num_repeats_(0)
+            , repeats_since_ns_(0)
+            , repeat_logger_(nullptr)
+            , repeat_site_(nullptr)
+            , repeat_level_(0) {
+        }
+
+        /**
+         * Reports any collapsed repeats and dropped records not yet
+         * reported.
+         */
+        ~LogThrottle();
+
+        LogThrottle(const LogThrottle &) = delete;
+        LogThrottle & operator=(const LogThrottle &) = delete;
+
+        /**
+         * Takes a token from the bucket if one is available.
+         *
+         * @return  <code>true</code> if the record may be logged
+         */
+        bool admit() {
+            if (this->interval_ns_ == 0) {
+                return true;
+            }
+            std::int64_t now = LogThrottle::now_ns();
+            std::int64_t tat = this->theoretical_arrival_ns_.load(std::memory_order_relaxed);
+            while (true) {
+                if (now < tat - this->tolerance_ns_) {
+                    this->num_dropped_.fetch_add(1, std::memory_order_relaxed);
+                    return false;
+                }
+                std::int64_t next_tat = (tat > now ? tat : now) + this->interval_ns_;
+                if (this->theoretical_arrival_ns_.compare_exchange_weak(tat, next_tat, std::memory_order_relaxed)) {
+                    return true;
+                }
+            }
+        }
+
+        /**
+         * Records the hash of an admitted record's arguments.
+         *
+         * @param hash  hash of record arguments
+         * @return      <code>true</code> if the record repeats the previous
+         *              one and should not be logged
+         */
+        bool is_repeat(std::uint64_t hash) {
+            if (!this->collapse_duplicates_) {
+                return false;
+            }
+            if (this->last_hash_.exchange(hash, std::memory_order_relaxed) == hash) {
+                this->num_repeats_.fetch_add(1, std::memory_order_relaxed);
+                return true;
+            }
+            return false;
+        }
+
+        bool collapse_duplicates() const {
+            return this->collapse_duplicates_;
+        }
+
+        /** Returns and resets the number of records dropped by the rate limit. */
+        unsigned long take_num_dropped() {
+            return this->num_dropped_.exchange(0, std::memory_order_relaxed);
+        }
+
+        /** Returns and resets the number of collapsed repeats. */
+        unsigned long take_num_repeats() {
+            return this->num_repeats_.exchange(0, std::memory_order_relaxed);
+        }
+
+        /**
+         * Monotonic clock used for rate limiting. Uses the coarse
+         * (tick-resolution) clock where available, which is considerably
+         * cheaper to read than the precise one.
+         */
+        static std::int64_t now_ns() {
+#if defined(CLOCK_MONOTONIC_COARSE)
+            struct timespec ts;
+            clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+            return static_cast<std::int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+#else
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+        }
+
+    private:
+        const std::int64_t              interval_ns_;
+        const std::int64_t              tolerance_ns_;
+        const bool                      collapse_duplicates_;
+        const std::int64_t              repeat_report_ns_;
+        std::atomic<std::int64_t>       theoretical_arrival_ns_;
+        std::atomic<unsigned long>      num_dropped_;
+        std::atomic<std::uint64_t>      last_hash_;
+        std::atomic<unsigned long>      num_repeats_;
+        // time of first unreported repeat or dropped record (0 if none); the
+        // logger, site and level to report them with are guarded by
+        // Logger::pending_repeats_mutex_()
+        std::atomic<std::int64_t>       repeats_since_ns_;
+        Logger *                        repeat_logger_;
+        const logbinary::CallSite *     repeat_site_;
+        int                             repeat_level_;
+
+    friend class Logger;
+
+}; // LogThrottle
+
+///////////////////////////////////////////////////////////////////////////////
+// Logger
+
+/**
+ * Multi-channel logger.
+ *
+ * Logging is thread-safe: each thread formats records into its own buffer,
+ * and each complete record is handed to a channel's sink in a single
+ * append() call. Channels should be configured before logging starts from
+ * multiple threads.
+ *
+ * A channel renders records as text, as JSON lines, or in the compact
+ * binary format described in logbinary.hpp, which skips text formatting
+ * altogether and can be rendered back to text offline (see logdecode.hpp).
+ * JSON records have the form:
+ *
+ *      {"logger":"name","time":"...","level":"INFO","message":"...",key:value,...}
+ *
+ * with "time" present only for timestamped channels, and one member for
+ * each field passed with kv().
+ *
+ * Loggers obtained from LoggerRegistry form a hierarchy by dotted name
+ * ("io" is the parent of "io.reader"). Such a logger inherits its level
+ * from its nearest ancestor with an explicitly set level, and (unless
+ * propagation is switched off) also writes its records to the channels of
+ * its ancestors. The effective threshold of each logger is precomputed
+ * whenever levels or channels change, so checking whether a level is
+ * enabled is a single relaxed atomic load.
+ */
+class LoggerRegistry;
+
 class Logger {
 
     public:
@@ -45,31 +541,120 @@ class Logger {
             ABORTING=60,
         };
 
+        enum class ChannelFormat {
+            TEXT,
+            BINARY,
+            JSON,
+        };
+
     public:
         Logger(const std::string& name)
-                : name_(name) {
-            this->level_descs_[Logger::LoggingLevel::VVERBOSE] = "VVERBOSE";
-            this->level_descs_[Logger::LoggingLevel::VERBOSE]  = "VERBOSE";
-            this->level_descs_[Logger::LoggingLevel::DEBUG]    = "DEBUG";
-            this->level_descs_[Logger::LoggingLevel::INFO]     = "INFO";
-            this->level_descs_[Logger::LoggingLevel::WARNING]  = "WARNING";
-            this->level_descs_[Logger::LoggingLevel::ERROR]    = "ERROR";
-            this->level_descs_[Logger::LoggingLevel::CRITICAL] = "CRITICAL";
-            this->level_descs_[Logger::LoggingLevel::ABORTING] = "ABORTING";
+                : name_(name)
+                , source_id_(logbinary::Registry::get().add_source(name))
+                , level_(Logger::LoggingLevel::NOTSET)
+                , effective_level_(Logger::LoggingLevel::NOTSET)
+                , parent_(nullptr)
+                , propagate_(true)
+                , registered_(false)
+                , output_threshold_(INT_MAX)
+                , threshold_(INT_MAX) {
+            this->add_live_();
+        }
+
+        /**
+         * Copies name, channels and level. The copy stands alone: it is not
+         * part of the registry hierarchy, though it still writes to its
+         * ancestors' channels if the original did.
+         */
+        Logger(const Logger & other)
+                : name_(other.name_)
+                , source_id_(other.source_id_)
+                , channels_(other.channels_)
+                , level_(other.level_)
+                , effective_level_(other.effective_level_)
+                , parent_(other.parent_)
+                , propagate_(other.propagate_)
+                , registered_(false)
+                , output_threshold_(other.output_threshold_.load(std::memory_order_relaxed))
+                , threshold_(other.threshold_.load(std::memory_order_relaxed)) {
+            this->add_live_();
+        }
+
+        ~Logger() {
+            this->report_own_repeats_();
+            std::lock_guard<std::mutex> lock(Logger::live_mutex_());
+            Logger::live_loggers_().erase(this);
+        }
+
+        Logger & operator=(const Logger &) = delete;
+
+        const std::string & get_name() const {
+            return this->name_;
+        }
+
+        /**
+         * Sets the minimum level of records logged by this logger (in
+         * addition to the level of each channel). NOTSET means the level is
+         * inherited from the parent logger.
+         *
+         * @param level     logging level
+         */
+        void set_level(Logger::LoggingLevel level);
+
+        Logger::LoggingLevel get_level() const {
+            return this->level_;
         }
 
+        Logger::LoggingLevel get_effective_level() const {
+            return this->effective_level_;
+        }
+
+        /**
+         * Sets whether records are also written to ancestors' channels.
+         *
+         * @param propagate     <code>true</code> to write to ancestors' channels
+         */
+        void set_propagate(bool propagate);
+
         void add_channel(std::ostream& dest,
                 Logger::LoggingLevel logging_level,
                 int timestamp=0,
-                Logger::LoggingLevel decoration_level=Logger::LoggingLevel::NOTSET) {
-            this->channels_[&dest] = logging_level;
-            this->channel_time_decoration_[&dest] = timestamp;
-            this->channel_decoration_level_[&dest] = decoration_level;
+                Logger::LoggingLevel decoration_level=Logger::LoggingLevel::NOTSET,
+                Logger::ChannelFormat format=Logger::ChannelFormat::TEXT) {
+            this->add_channel(StreamLogSink::get(dest), logging_level, timestamp, decoration_level, format);
+        }
+
+        void add_channel(const std::shared_ptr<LogSink>& sink,
+                Logger::LoggingLevel logging_level,
+                int timestamp=0,
+                Logger::LoggingLevel decoration_level=Logger::LoggingLevel::NOTSET,
+                Logger::ChannelFormat format=Logger::ChannelFormat::TEXT) {
+            Channel * channel = nullptr;
+            for (auto & ch : this->channels_) {
+                if (ch.sink == sink) {
+                    channel = &ch;
+                    break;
+                }
+            }
+            if (channel == nullptr) {
+                this->channels_.emplace_back();
+                channel = &this->channels_.back();
+                channel->sink = sink;
+            }
+            channel->logging_level = logging_level;
+            channel->timestamp = timestamp;
+            channel->decoration_level = decoration_level;
+            channel->format = format;
+            if (format == Logger::ChannelFormat::BINARY && !channel->binary_state) {
+                channel->binary_state = Logger::binary_channel_state_(sink);
+            }
+            this->update_thresholds_();
         }
 
         template <typename... Types>
         void abort(const Types&... args) {
             this->log(Logger::LoggingLevel::ABORTING, args...);
+            console::run_abort_hook();
             exit(EXIT_FAILURE);
         }
 
@@ -110,28 +695,691 @@ class Logger {
 
         template <typename... Types>
         void log(const Logger::LoggingLevel& message_level, const Types&... args) {
-            for (auto & ch_iter : this->channels_) {
-                if (message_level >= ch_iter.second) {
-                    auto & chout = *(ch_iter.first);
-                    chout << "[" << this->name_ << "]";
-                    if (this->channel_time_decoration_[ch_iter.first] > 0) {
-                        std::time(&this->time_struct_);
-                        std::strftime(this->time_str_buffer_, 20,
-                                "%Y-%m-%d %H:%M:%S", std::localtime(&this->time_struct_));
-                        chout << " - " << this->time_str_buffer_;
-                    }
-                    if (message_level == Logger::LoggingLevel::NOTSET || message_level >= this->channel_decoration_level_[ch_iter.first]) {
-                        chout << " - " << this->level_descs_[message_level];
+            this->log_at(logbinary::CallSite::anonymous(), message_level, args...);
+        }
+
+        /**
+         * Logs a record attributed to a particular call site. Usually invoked
+         * through the COLUGO_LOG macro, which supplies the site.
+         *
+         * @param site              static description of the logging statement
+         * @param message_level     level of record
+         * @param args              message elements
+         */
+        template <typename... Types>
+        void log_at(const logbinary::CallSite& site, const Logger::LoggingLevel& message_level, const Types&... args) {
+            if (!this->is_enabled(message_level)) {
+                return;
+            }
+            this->write_record_(site, message_level, args...);
+        }
+
+        /**
+         * Logs a record subject to the rate limit and duplicate suppression
+         * of a call site. Usually invoked through the COLUGO_LOG_THROTTLED
+         * macro, which supplies the site and its throttle.
+         *
+         * @param site              static description of the logging statement
+         * @param throttle          static throttle state of the logging statement
+         * @param message_level     level of record
+         * @param args              message elements
+         */
+        template <typename... Types>
+        void log_throttled(const logbinary::CallSite& site,
+                LogThrottle& throttle,
+                const Logger::LoggingLevel& message_level,
+                const Types&... args) {
+            if (!throttle.admit()) {
+                this->note_repeat_(site, throttle, message_level);
+                return;
+            }
+            if (throttle.collapse_duplicates()) {
+                // deferred arguments are compared only if the record is
+                // going to be written anyway
+                std::uint64_t hash = 0;
+                {
+                    BufferLease lease;
+                    std::string & scratch = lease.get().scratch;
+                    scratch.clear();
+                    if (static_cast<int>(message_level) >= this->output_threshold_.load(std::memory_order_relaxed)) {
+                        logbinary::encode_args(scratch, args...);
+                    } else {
+                        logbinary::encode_args(scratch, Logger::unevaluated_(args)...);
                     }
-                    chout << " - ";
-                    this->emit_(chout, args...);
-                    chout << std::endl;
+                    hash = Logger::hash_bytes_(scratch.data(), scratch.size());
+                }
+                if (throttle.is_repeat(hash)) {
+                    this->note_repeat_(site, throttle, message_level);
+                    return;
                 }
             }
+            Logger::report_repeats_(throttle);
+            this->log_at(site, message_level, args...);
+        }
+
+        /**
+         * Returns <code>true</code> if a record at the given level would be
+         * written to at least one channel.
+         *
+         * @param message_level     level of record
+         * @return                  <code>true</code> if level is enabled
+         */
+        bool is_enabled(Logger::LoggingLevel message_level) const {
+            return static_cast<int>(message_level) >= this->threshold_.load(std::memory_order_relaxed);
+        }
+
+        /**
+         * Function receiving a binary-encoded copy of every record at or
+         * above the capture level, whether or not any channel accepts it
+         * (see FlightRecorder).
+         */
+        typedef void (*CaptureHook)(const char * record, std::size_t size);
+
+        /**
+         * Installs (or, with <code>nullptr</code>, removes) the capture
+         * hook. Lowers the thresholds of all loggers so that records down to
+         * <code>capture_level</code> reach the hook.
+         *
+         * @param hook              function receiving captured records
+         * @param capture_level     lowest level captured
+         */
+        static void set_capture_hook(CaptureHook hook, Logger::LoggingLevel capture_level) {
+            std::lock_guard<std::mutex> lock(Logger::live_mutex_());
+            Logger::capture_hook_().store(hook, std::memory_order_release);
+            int level = hook == nullptr ? INT_MAX : static_cast<int>(capture_level);
+            Logger::capture_level_().store(level, std::memory_order_relaxed);
+            for (auto logger : Logger::live_loggers_()) {
+                logger->apply_capture_level_();
+            }
+        }
+
+        /**
+         * Returns display name of a logging level.
+         *
+         * @param level     logging level
+         * @return          name of level
+         */
+        static const char * level_name(Logger::LoggingLevel level) {
+            switch (level) {
+                case Logger::LoggingLevel::NOTSET:   return "NOTSET";
+                case Logger::LoggingLevel::VVERBOSE: return "VVERBOSE";
+                case Logger::LoggingLevel::VERBOSE:  return "VERBOSE";
+                case Logger::LoggingLevel::DEBUG:    return "DEBUG";
+                case Logger::LoggingLevel::INFO:     return "INFO";
+                case Logger::LoggingLevel::WARNING:  return "WARNING";
+                case Logger::LoggingLevel::ERROR:    return "ERROR";
+                case Logger::LoggingLevel::CRITICAL: return "CRITICAL";
+                case Logger::LoggingLevel::ABORTING: return "ABORTING";
+            }
+            return "";
         }
 
     private:
 
+        /**
+         * Tracks which source and call site definitions have already been
+         * written to a binary sink. Since registry ids are dense, a
+         * single counter per table suffices, and the common case is two
+         * atomic loads. One instance is shared by all loggers writing to the
+         * same sink.
+         */
+        struct BinaryChannelState {
+            std::mutex                  mutex;
+            std::atomic<std::uint32_t>  num_sources_announced{0};
+            std::atomic<std::uint32_t>  num_sites_announced{0};
+            std::atomic<std::uint32_t>  num_formats_announced{1};    // id 0 is never used
+        };
+
+        struct Channel {
+            std::shared_ptr<LogSink>                sink;
+            Logger::LoggingLevel                    logging_level;
+            int                                     timestamp;
+            Logger::LoggingLevel                    decoration_level;
+            Logger::ChannelFormat                   format;
+            std::shared_ptr<BinaryChannelState>     binary_state;
+        };
+
+        /**
+         * Per-thread formatting state. Nothing here is shared between
+         * threads, so records are assembled without any locking.
+         */
+        struct RecordBuffer {
+            RecordBuffer()
+                : body_buf(&body)
+                , body_out(&body_buf)
+                , json_out(&json_buf)
+                , time_struct(-1) {
+                time_str_buffer[0] = '\0';
+            }
+
+            void reset_body() {
+                this->body.clear();
+                RecordBuffer::reset_stream(this->body_out);
+            }
+
+            static void reset_stream(std::ostream & out) {
+                out.clear();
+                out.flags(std::ios_base::dec | std::ios_base::skipws);
+                out.precision(6);
+                out.fill(' ');
+            }
+
+            const char * time_string() {
+                std::time_t now = std::time(nullptr);
+                if (now != this->time_struct) {
+                    std::tm local_tm;
+                    localtime_r(&now, &local_tm);
+                    std::strftime(this->time_str_buffer, 20, "%Y-%m-%d %H:%M:%S", &local_tm);
+                    this->time_struct = now;
+                }
+                return this->time_str_buffer;
+            }
+
+            std::string                 body;
+            std::string                 record;
+            std::string                 binary;
+            std::string                 scratch;
+            stream::StringAppendBuf     body_buf;
+            std::ostream                body_out;
+            json::EscapingStreamBuf     json_buf;
+            std::ostream                json_out;
+            std::time_t                 time_struct;
+            char                        time_str_buffer[20];
+        };
+
+        /**
+         * Recomputes the effective level and threshold of this logger and,
+         * if it belongs to the registry, of all other registered loggers
+         * (since they may inherit its level or write to its channels).
+         */
+        void update_thresholds_();
+
+        /**
+         * Recomputes effective level and threshold from this logger's level
+         * and channels and those of its ancestors. Ancestors must already
+         * be up to date.
+         */
+        void compute_threshold_() {
+            if (this->level_ != Logger::LoggingLevel::NOTSET || this->parent_ == nullptr) {
+                this->effective_level_ = this->level_;
+            } else {
+                this->effective_level_ = this->parent_->effective_level_;
+            }
+            int min_channel_level = INT_MAX;
+            for (const Logger * lg = this; lg != nullptr; lg = lg->propagate_ ? lg->parent_ : nullptr) {
+                for (auto & ch : lg->channels_) {
+                    if (static_cast<int>(ch.logging_level) < min_channel_level) {
+                        min_channel_level = static_cast<int>(ch.logging_level);
+                    }
+                }
+            }
+            int threshold = static_cast<int>(this->effective_level_);
+            if (min_channel_level > threshold) {
+                threshold = min_channel_level;
+            }
+            this->output_threshold_.store(threshold, std::memory_order_relaxed);
+            this->apply_capture_level_();
+        }
+
+        /**
+         * Sets the gating threshold to the lower of the output threshold
+         * and the capture level.
+         */
+        void apply_capture_level_() {
+            int threshold = this->output_threshold_.load(std::memory_order_relaxed);
+            int capture_level = Logger::capture_level_().load(std::memory_order_relaxed);
+            this->threshold_.store(capture_level < threshold ? capture_level : threshold, std::memory_order_relaxed);
+        }
+
+        static std::atomic<CaptureHook> & capture_hook_() {
+            static std::atomic<CaptureHook> hook(nullptr);
+            return hook;
+        }
+
+        static std::atomic<int> & capture_level_() {
+            static std::atomic<int> level(INT_MAX);
+            return level;
+        }
+
+        /**
+         * All existing loggers, so that a change in capture level can be
+         * applied to each. Never destroyed, since loggers with static
+         * storage duration (including those of the registry) remove
+         * themselves during exit.
+         */
+        static std::set<Logger *> & live_loggers_() {
+            static std::set<Logger *> * loggers = new std::set<Logger *>();
+            return *loggers;
+        }
+
+        static std::mutex & live_mutex_() {
+            static std::mutex * mutex = new std::mutex();
+            return *mutex;
+        }
+
+        void add_live_() {
+            std::lock_guard<std::mutex> lock(Logger::live_mutex_());
+            Logger::live_loggers_().insert(this);
+            this->apply_capture_level_();
+        }
+
+        template <typename... Types>
+        void encode_binary_(RecordBuffer & buffer,
+                const logbinary::CallSite & site,
+                Logger::LoggingLevel message_level,
+                const Types&... args) const {
+            buffer.binary.clear();
+            logbinary::encode_log_record(buffer.binary,
+                    static_cast<std::uint8_t>(message_level),
+                    0,
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        std::chrono::system_clock::now().time_since_epoch()).count(),
+                    this->source_id_,
+                    site.id,
+                    args...);
+        }
+
+        /**
+         * Returns the binary state shared by all channels writing to
+         * <code>sink</code>, writing the file header to the sink when it is
+         * first used as a binary channel, and arranging for files the sink
+         * opens later to start with a header and definitions.
+         */
+        static std::shared_ptr<BinaryChannelState> binary_channel_state_(const std::shared_ptr<LogSink>& sink) {
+            // never destroyed, so that channels can be added during exit
+            static std::mutex * registry_mutex = new std::mutex();
+            static auto * registry = new std::map<LogSink *, std::weak_ptr<BinaryChannelState>>();
+            std::lock_guard<std::mutex> lock(*registry_mutex);
+            auto & entry = (*registry)[sink.get()];
+            auto state = entry.lock();
+            if (!state) {
+                state = std::make_shared<BinaryChannelState>();
+                entry = state;
+                std::string header;
+                logbinary::encode_file_header(header);
+                sink->append(header.data(), header.size());
+                sink->set_preamble(&Logger::encode_binary_preamble_);
+            }
+            return state;
+        }
+
+        /**
+         * Encodes a file header followed by the definitions of all sources,
+         * call sites and format strings registered so far.
+         */
+        static void encode_binary_preamble_(std::string & out) {
+            auto & registry = logbinary::Registry::get();
+            logbinary::encode_file_header(out);
+            std::uint32_t num_sources = registry.num_sources();
+            for (std::uint32_t id = 0; id < num_sources; ++id) {
+                logbinary::encode_source_definition(out, id, registry.source_name(id));
+            }
+            std::uint32_t num_sites = registry.num_sites();
+            for (std::uint32_t id = 0; id < num_sites; ++id) {
+                logbinary::encode_site_definition(out, id, registry.site(id));
+            }
+            std::uint32_t num_formats = registry.num_formats();
+            for (std::uint32_t id = 1; id < num_formats; ++id) {
+                logbinary::encode_format_definition(out, id, registry.format_pieces(id));
+            }
+        }
+
+        struct ThreadRecordBuffer {
+            explicit ThreadRecordBuffer(bool & destroyed)
+                : in_use(false)
+                , destroyed(destroyed) {
+            }
+            ~ThreadRecordBuffer() {
+                this->destroyed = true;
+            }
+            RecordBuffer    buffer;
+            bool            in_use;
+            bool &          destroyed;
+        };
+
+        /**
+         * Returns the calling thread's record buffer, or
+         * <code>nullptr</code> if it has already been destroyed (when
+         * logging from a static destructor, during exit).
+         */
+        static ThreadRecordBuffer * thread_buffer_() {
+            // trivially destructible, so still readable after the buffer
+            // itself is destroyed
+            thread_local bool destroyed = false;
+            thread_local ThreadRecordBuffer buffer(destroyed);
+            return destroyed ? nullptr : &buffer;
+        }
+
+        /**
+         * The record buffer used while writing one record: the calling
+         * thread's, if available, otherwise a temporary one. The thread's
+         * buffer is unavailable while it is already leased, i.e., when a
+         * lazy argument being evaluated for one record itself logs.
+         */
+        class BufferLease {
+            public:
+                BufferLease()
+                    : leased_(Logger::thread_buffer_()) {
+                    if (this->leased_ != nullptr && !this->leased_->in_use) {
+                        this->leased_->in_use = true;
+                        this->buffer_ = &this->leased_->buffer;
+                    } else {
+                        this->leased_ = nullptr;
+                        this->temporary_.emplace();
+                        this->buffer_ = &*this->temporary_;
+                    }
+                }
+                ~BufferLease() {
+                    if (this->leased_ != nullptr) {
+                        this->leased_->in_use = false;
+                    }
+                }
+                BufferLease(const BufferLease &) = delete;
+                BufferLease & operator=(const BufferLease &) = delete;
+                RecordBuffer & get() {
+                    return *this->buffer_;
+                }
+            private:
+                ThreadRecordBuffer *            leased_;
+                RecordBuffer *                  buffer_;
+                std::optional<RecordBuffer>     temporary_;
+        };
+
+        /**
+         * Writes a record to the capture hook and to every channel that
+         * accepts it. Deferred arguments are only evaluated if some channel
+         * accepts the record.
+         */
+        template <typename... Types>
+        void write_record_(const logbinary::CallSite& site, Logger::LoggingLevel message_level, const Types&... args) {
+            BufferLease lease;
+            RecordBuffer & buffer = lease.get();
+            bool body_formatted = false;
+            bool binary_encoded = false;
+            bool accepted = static_cast<int>(message_level) >= this->output_threshold_.load(std::memory_order_relaxed);
+            if (static_cast<int>(message_level) >= Logger::capture_level_().load(std::memory_order_relaxed)) {
+                CaptureHook hook = Logger::capture_hook_().load(std::memory_order_acquire);
+                if (hook != nullptr) {
+                    if (accepted) {
+                        this->encode_binary_(buffer, site, message_level, args...);
+                        binary_encoded = true;
+                    } else {
+                        this->encode_binary_(buffer, site, message_level, Logger::unevaluated_(args)...);
+                    }
+                    buffer.binary[logbinary::RECORD_FLAGS_OFFSET] = static_cast<char>(logbinary::SHOW_TIME | logbinary::SHOW_LEVEL);
+                    hook(buffer.binary.data(), buffer.binary.size());
+                }
+            }
+            if (!accepted) {
+                return;
+            }
+            for (const Logger * lg = this; lg != nullptr; lg = lg->propagate_ ? lg->parent_ : nullptr) {
+                for (auto & ch : lg->channels_) {
+                    if (message_level < ch.logging_level) {
+                        continue;
+                    }
+                    bool show_level = message_level == Logger::LoggingLevel::NOTSET || message_level >= ch.decoration_level;
+                    if (ch.format == Logger::ChannelFormat::BINARY) {
+                        if (!binary_encoded) {
+                            this->encode_binary_(buffer, site, message_level, args...);
+                            binary_encoded = true;
+                        }
+                        buffer.binary[logbinary::RECORD_FLAGS_OFFSET] = static_cast<char>(
+                                (ch.timestamp > 0 ? logbinary::SHOW_TIME : 0)
+                                | (show_level ? logbinary::SHOW_LEVEL : 0));
+                        this->announce_(ch, site);
+                        ch.sink->append_at_level(static_cast<int>(message_level), buffer.binary.data(), buffer.binary.size());
+                        continue;
+                    }
+                    if (ch.format == Logger::ChannelFormat::JSON) {
+                        this->format_json_(buffer, message_level, ch.timestamp > 0, args...);
+                        ch.sink->append_at_level(static_cast<int>(message_level), buffer.record.data(), buffer.record.size());
+                        continue;
+                    }
+                    if (!body_formatted) {
+                        buffer.reset_body();
+                        this->emit_(buffer.body_out, args...);
+                        body_formatted = true;
+                    }
+                    std::string & record = buffer.record;
+                    record.clear();
+                    record += '[';
+                    record += this->name_;
+                    record += ']';
+                    if (ch.timestamp > 0) {
+                        record += " - ";
+                        record += buffer.time_string();
+                    }
+                    if (show_level) {
+                        record += " - ";
+                        record += Logger::level_name(message_level);
+                    }
+                    record += " - ";
+                    record += buffer.body;
+                    record += '\n';
+                    ch.sink->append_at_level(static_cast<int>(message_level), record.data(), record.size());
+                }
+            }
+        }
+
+        /**
+         * Arranges for a collapsed repeat or a record dropped by the rate
+         * limit to be reported, now if the first unreported one is older
+         * than the throttle's report interval.
+         */
+        void note_repeat_(const logbinary::CallSite& site,
+                LogThrottle& throttle,
+                Logger::LoggingLevel message_level) {
+            std::int64_t now = LogThrottle::now_ns();
+            std::int64_t since = throttle.repeats_since_ns_.load(std::memory_order_relaxed);
+            if (since == 0) {
+                std::lock_guard<std::mutex> lock(Logger::pending_repeats_mutex_());
+                if (throttle.repeat_logger_ == nullptr) {
+                    throttle.repeat_logger_ = this;
+                    throttle.repeat_site_ = &site;
+                    throttle.repeat_level_ = static_cast<int>(message_level);
+                    throttle.repeats_since_ns_.store(now, std::memory_order_relaxed);
+                    Logger::pending_repeats_().insert(&throttle);
+                }
+            } else if (now - since >= throttle.repeat_report_ns_) {
+                Logger::report_repeats_(throttle);
+            }
+        }
+
+        /**
+         * Reports and resets a throttle's collapsed repeats and records
+         * dropped by the rate limit, if any.
+         */
+        static void report_repeats_(LogThrottle& throttle) {
+            if (throttle.repeats_since_ns_.load(std::memory_order_relaxed) == 0) {
+                return;
+            }
+            Logger * logger = nullptr;
+            const logbinary::CallSite * site = nullptr;
+            int level = 0;
+            {
+                std::lock_guard<std::mutex> lock(Logger::pending_repeats_mutex_());
+                if (throttle.repeat_logger_ == nullptr) {
+                    return;
+                }
+                logger = throttle.repeat_logger_;
+                site = throttle.repeat_site_;
+                level = throttle.repeat_level_;
+                Logger::detach_repeats_(throttle);
+            }
+            unsigned long num_repeats = throttle.take_num_repeats();
+            if (num_repeats > 0) {
+                logger->log_at(*site, static_cast<Logger::LoggingLevel>(level), "last message repeated ", num_repeats, " times");
+            }
+            unsigned long num_dropped = throttle.take_num_dropped();
+            if (num_dropped > 0) {
+                logger->log_at(*site, static_cast<Logger::LoggingLevel>(level), num_dropped, " messages suppressed by rate limit");
+            }
+        }
+
+        /**
+         * Reports the collapsed repeats and dropped records of all throttles
+         * that would report them through this logger.
+         */
+        void report_own_repeats_() {
+            std::vector<LogThrottle *> throttles;
+            {
+                std::lock_guard<std::mutex> lock(Logger::pending_repeats_mutex_());
+                for (LogThrottle * throttle : Logger::pending_repeats_()) {
+                    if (throttle->repeat_logger_ == this) {
+                        throttles.push_back(throttle);
+                    }
+                }
+            }
+            for (LogThrottle * throttle : throttles) {
+                Logger::report_repeats_(*throttle);
+            }
+        }
+
+        /** Requires pending_repeats_mutex_(). */
+        static void detach_repeats_(LogThrottle& throttle) {
+            throttle.repeat_logger_ = nullptr;
+            throttle.repeat_site_ = nullptr;
+            throttle.repeats_since_ns_.store(0, std::memory_order_relaxed);
+            Logger::pending_repeats_().erase(&throttle);
+        }
+
+        /**
+         * Throttles with unreported repeats or dropped records. Never
+         * destroyed, since
+         * throttles and loggers with static storage duration may report
+         * repeats during exit.
+         */
+        static std::set<LogThrottle *> & pending_repeats_() {
+            static std::set<LogThrottle *> * throttles = new std::set<LogThrottle *>();
+            return *throttles;
+        }
+
+        static std::mutex & pending_repeats_mutex_() {
+            static std::mutex * mutex = new std::mutex();
+            return *mutex;
+        }
+
+        /**
+         * Substitutes a placeholder for deferred arguments (including field
+         * values), for encoding records without evaluating them.
+         */
+        template <typename T>
+        static decltype(auto) unevaluated_(const T & arg) {
+            if constexpr (is_lazy_arg<T>::value) {
+                return (Logger::unevaluated_text_());
+            } else if constexpr (is_log_field<T>::value) {
+                if constexpr (is_lazy_arg<typename std::decay<decltype(arg.value)>::type>::value) {
+                    return LogField<const char *>{arg.key, Logger::unevaluated_text_()};
+                } else {
+                    return (arg);
+                }
+            } else {
+                return (arg);
+            }
+        }
+
+        static const char * const & unevaluated_text_() {
+            static const char * const text = "<unevaluated>";
+            return text;
+        }
+
+        /**
+         * Writes definitions of any sources, call sites and format strings
+         * (up to and including those of the current record) not yet seen
+         * by a binary channel.
+         */
+        void announce_(const Channel & ch, const logbinary::CallSite & site) const {
+            BinaryChannelState & state = *ch.binary_state;
+            auto & registry = logbinary::Registry::get();
+            if (this->source_id_ < state.num_sources_announced.load(std::memory_order_acquire)
+                    && site.id < state.num_sites_announced.load(std::memory_order_acquire)
+                    && registry.num_formats() <= state.num_formats_announced.load(std::memory_order_acquire)) {
+                return;
+            }
+            std::lock_guard<std::mutex> lock(state.mutex);
+            std::string definitions;
+            std::uint32_t num_sources = registry.num_sources();
+            for (std::uint32_t id = state.num_sources_announced.load(); id < num_sources; ++id) {
+                logbinary::encode_source_definition(definitions, id, registry.source_name(id));
+            }
+            std::uint32_t num_sites = registry.num_sites();
+            for (std::uint32_t id = state.num_sites_announced.load(); id < num_sites; ++id) {
+                logbinary::encode_site_definition(definitions, id, registry.site(id));
+            }
+            std::uint32_t num_formats = registry.num_formats();
+            for (std::uint32_t id = state.num_formats_announced.load(); id < num_formats; ++id) {
+                logbinary::encode_format_definition(definitions, id, registry.format_pieces(id));
+            }
+            if (!definitions.empty()) {
+                ch.sink->append(definitions.data(), definitions.size());
+            }
+            state.num_sources_announced.store(num_sources, std::memory_order_release);
+            state.num_sites_announced.store(num_sites, std::memory_order_release);
+            state.num_formats_announced.store(num_formats, std::memory_order_release);
+        }
+
+        /**
+         * Renders a record as a single line JSON object into the thread's
+         * record buffer. Message elements are escaped as they are written,
+         * straight into the record.
+         */
+        template <typename... Types>
+        void format_json_(RecordBuffer & buffer,
+                Logger::LoggingLevel message_level,
+                bool show_time,
+                const Types&... args) {
+            std::string & record = buffer.record;
+            record.clear();
+            record += "{\"logger\":";
+            json::append_string(record, this->name_.data(), this->name_.size());
+            if (show_time) {
+                record += ",\"time\":\"";
+                record += buffer.time_string();
+                record += '"';
+            }
+            record += ",\"level\":\"";
+            record += Logger::level_name(message_level);
+            record += "\",\"message\":\"";
+            buffer.json_buf.set_destination(&record);
+            RecordBuffer::reset_stream(buffer.json_out);
+            (Logger::write_message_arg_(buffer.json_out, args), ...);
+            record += '"';
+            (Logger::append_json_field_(record, args), ...);
+            record += "}\n";
+        }
+
+        template <typename T>
+        static void write_message_arg_(std::ostream & out, const T & arg) {
+            if constexpr (!is_log_field<T>::value) {
+                stream::write(out, arg);
+            }
+        }
+
+        template <typename T>
+        static void append_json_field_(std::string & record, const T & arg) {
+            if constexpr (is_log_field<T>::value) {
+                record += ',';
+                json::append_string(record, arg.key, std::strlen(arg.key));
+                record += ':';
+                if constexpr (is_lazy_arg<typename std::decay<decltype(arg.value)>::type>::value) {
+                    json::append_value(record, arg.value.get());
+                } else {
+                    json::append_value(record, arg.value);
+                }
+            }
+        }
+
+        /** FNV-1a. */
+        static std::uint64_t hash_bytes_(const char * data, std::size_t size) {
+            std::uint64_t hash = 14695981039346656037ULL;
+            for (std::size_t i = 0; i < size; ++i) {
+                hash ^= static_cast<unsigned char>(data[i]);
+                hash *= 1099511628211ULL;
+            }
+            return hash;
+        }
+
         template <typename... Types>
         void emit_(std::ostream & out, const Types&... args) {
             colugo::stream::write(out, args...);
@@ -139,15 +1387,245 @@ class Logger {
 
     private:
         std::string                                      name_;
-        std::map<std::ostream *, Logger::LoggingLevel>   channels_;
-        std::map<std::ostream *, int>                    channel_time_decoration_;
-        std::map<std::ostream *, Logger::LoggingLevel>   channel_decoration_level_;
-        std::map<Logger::LoggingLevel, const char *>     level_descs_;
-        std::time_t                                      time_struct_;
-        char                                             time_str_buffer_[20];
+        std::uint32_t                                    source_id_;
+        std::vector<Channel>                             channels_;
+        Logger::LoggingLevel                             level_;
+        Logger::LoggingLevel                             effective_level_;
+        Logger *                                         parent_;
+        bool                                             propagate_;
+        bool                                             registered_;
+        std::atomic<int>                                 output_threshold_;
+        std::atomic<int>                                 threshold_;
+
+    friend class LoggerRegistry;
+    friend class LogThrottle;
 
 }; // Logger
 
+///////////////////////////////////////////////////////////////////////////////
+// LoggerRegistry
+
+/**
+ * Process-wide collection of hierarchically-named loggers.
+ *
+ * Levels can be set through the API (set_level(), configure()) or, at
+ * start up, through the COLUGO_LOG_LEVEL environment variable, which takes
+ * a comma-separated list of "name=LEVEL" entries, with a bare "LEVEL"
+ * applying to the root logger, e.g.:
+ *
+ *      COLUGO_LOG_LEVEL="WARNING,io=DEBUG,io.reader=INFO"
+ *
+ * Levels are given by name (case-insensitive) or number.
+ *
+ * The registry and its loggers are never destroyed, so loggers can be
+ * looked up and used by static destructors during exit. A sink that must
+ * be closed at exit should therefore also be held, and released, by the
+ * program.
+ */
+class LoggerRegistry {
+
+    public:
+        static LoggerRegistry & get() {
+            static LoggerRegistry * registry = new LoggerRegistry();
+            return *registry;
+        }
+
+        /**
+         * Returns the logger with the given dotted name, creating it (and
+         * any missing ancestors) if needed. The empty name refers to the
+         * root logger.
+         *
+         * @param name  logger name
+         * @return      logger
+         */
+        Logger & get_logger(const std::string & name) {
+            std::lock_guard<std::recursive_mutex> lock(this->mutex_);
+            return this->get_logger_(name);
+        }
+
+        Logger & root() {
+            return this->get_logger("");
+        }
+
+        /**
+         * Sets the level of a logger (creating it if needed), updating the
+         * thresholds of all loggers that inherit it.
+         *
+         * @param name      logger name
+         * @param level     logging level (NOTSET to inherit from parent)
+         */
+        void set_level(const std::string & name, Logger::LoggingLevel level) {
+            std::lock_guard<std::recursive_mutex> lock(this->mutex_);
+            this->get_logger_(name).level_ = level;
+            this->refresh_();
+        }
+
+        /**
+         * Applies a level specification, in the same format as the
+         * COLUGO_LOG_LEVEL environment variable.
+         *
+         * @param spec  comma-separated "name=LEVEL" or "LEVEL" entries
+         */
+        void configure(const std::string & spec) {
+            std::lock_guard<std::recursive_mutex> lock(this->mutex_);
+            for (auto & entry : textutil::split(spec, ",", 0, true, false)) {
+                std::string::size_type eq = entry.find('=');
+                Logger::LoggingLevel level;
+                if (eq == std::string::npos) {
+                    if (LoggerRegistry::parse_level(entry, level)) {
+                        this->get_logger_("").level_ = level;
+                    }
+                } else if (LoggerRegistry::parse_level(textutil::trim(entry.substr(eq + 1)), level)) {
+                    this->get_logger_(textutil::trim(entry.substr(0, eq))).level_ = level;
+                }
+            }
+            this->refresh_();
+        }
+
+        /**
+         * Parses a level name (case-insensitive) or number.
+         *
+         * @param s         level name or number
+         * @param level     set to the parsed level
+         * @return          <code>true</code> if <code>s</code> is a valid level
+         */
+        static bool parse_level(const std::string & s, Logger::LoggingLevel & level) {
+            static const Logger::LoggingLevel levels[] = {
+                Logger::LoggingLevel::NOTSET,
+                Logger::LoggingLevel::VVERBOSE,
+                Logger::LoggingLevel::VERBOSE,
+                Logger::LoggingLevel::DEBUG,
+                Logger::LoggingLevel::INFO,
+                Logger::LoggingLevel::WARNING,
+                Logger::LoggingLevel::ERROR,
+                Logger::LoggingLevel::CRITICAL,
+                Logger::LoggingLevel::ABORTING,
+            };
+            std::string name = textutil::upper(s);
+            for (auto lv : levels) {
+                if (name == Logger::level_name(lv)) {
+                    level = lv;
+                    return true;
+                }
+            }
+            if (!name.empty() && name.find_first_not_of("0123456789") == std::string::npos) {
+                level = static_cast<Logger::LoggingLevel>(std::atoi(name.c_str()));
+                return true;
+            }
+            return false;
+        }
+
+    private:
+        LoggerRegistry() {
+            const char * spec = std::getenv("COLUGO_LOG_LEVEL");
+            if (spec != nullptr) {
+                this->configure(spec);
+            }
+        }
+
+        LoggerRegistry(const LoggerRegistry &) = delete;
+        LoggerRegistry & operator=(const LoggerRegistry &) = delete;
+
+        Logger & get_logger_(const std::string & name) {
+            auto iter = this->loggers_.find(name);
+            if (iter != this->loggers_.end()) {
+                return *iter->second;
+            }
+            Logger * parent = nullptr;
+            if (!name.empty()) {
+                std::string::size_type dot = name.rfind('.');
+                parent = &this->get_logger_(dot == std::string::npos ? std::string() : name.substr(0, dot));
+            }
+            Logger * logger = new Logger(name.empty() ? std::string("root") : name);
+            logger->parent_ = parent;
+            logger->registered_ = true;
+            this->loggers_[name].reset(logger);
+            logger->compute_threshold_();
+            return *logger;
+        }
+
+        /**
+         * Recomputes all thresholds. Map order visits ancestors before
+         * their descendants, since a name sorts before any name it prefixes.
+         */
+        void refresh_() {
+            for (auto & entry : this->loggers_) {
+                entry.second->compute_threshold_();
+            }
+        }
+
+    private:
+        std::recursive_mutex                                mutex_;
+        std::map<std::string, std::unique_ptr<Logger>>      loggers_;
+
+    friend class Logger;
+
+}; // LoggerRegistry
+
+inline LogThrottle::~LogThrottle() {
+    Logger::report_repeats_(*this);
+}
+
+inline void Logger::set_level(Logger::LoggingLevel level) {
+    if (this->registered_) {
+        std::lock_guard<std::recursive_mutex> lock(LoggerRegistry::get().mutex_);
+        this->level_ = level;
+        LoggerRegistry::get().refresh_();
+    } else {
+        this->level_ = level;
+        this->compute_threshold_();
+    }
+}
+
+inline void Logger::set_propagate(bool propagate) {
+    this->propagate_ = propagate;
+    this->update_thresholds_();
+}
+
+inline void Logger::update_thresholds_() {
+    if (this->registered_) {
+        std::lock_guard<std::recursive_mutex> lock(LoggerRegistry::get().mutex_);
+        LoggerRegistry::get().refresh_();
+    } else {
+        this->compute_threshold_();
+    }
+}
+
+/**
+ * Returns the registered logger with the given dotted name (see
+ * LoggerRegistry::get_logger()).
+ */
+inline Logger & get_logger(const std::string & name) {
+    return LoggerRegistry::get().get_logger(name);
+}
+
 } // namespace colugo
 
+/**
+ * Logs a record through <code>logger</code>, tagged with the file, line
+ * and function of the logging statement. Arguments are not evaluated
+ * unless some channel of the logger accepts records at <code>level</code>.
+ */
+#define COLUGO_LOG(logger, level, ...) \
+    do { \
+        if ((logger).is_enabled(level)) { \
+            static const colugo::logbinary::CallSite colugo_log_call_site_(__FILE__, __LINE__, __FUNCTION__); \
+            (logger).log_at(colugo_log_call_site_, (level), __VA_ARGS__); \
+        } \
+    } while (0)
+
+/**
+ * As COLUGO_LOG, but admits at most <code>rate</code> records per second
+ * (with bursts of up to <code>burst</code>) from this statement, and
+ * collapses consecutive identical records.
+ */
+#define COLUGO_LOG_THROTTLED(logger, level, rate, burst, ...) \
+    do { \
+        if ((logger).is_enabled(level)) { \
+            static const colugo::logbinary::CallSite colugo_log_call_site_(__FILE__, __LINE__, __FUNCTION__); \
+            static colugo::LogThrottle colugo_log_throttle_((rate), (burst)); \
+            (logger).log_throttled(colugo_log_call_site_, colugo_log_throttle_, (level), __VA_ARGS__); \
+        } \
+    } while (0)
+
 #endif
@@ -0,0 +1,297 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright 2013 Jeet Sukumaran.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program. If not, see <http://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "logger.hpp"
+
+#if !defined(COLUGO_LOGMMAP_HPP)
+#define COLUGO_LOGMMAP_HPP
+
+namespace colugo {
+
+/**
+ * Log sink appending records to memory-mapped, preallocated file segments.
+ *
+ * Segments are named <code>prefix.000001</code>,
+ * <code>prefix.000002</code>, etc. Each is preallocated (posix_fallocate)
+ * and mapped when opened. Appending a record is an atomic fetch-and-add on
+ * the segment's cursor to reserve space, followed by a memcpy, so any number
+ * of threads can append concurrently without locks or system calls. When a
+ * segment fills up, the thread that overflows it maps the next one (the
+ * only locked path).
+ *
+ * A background thread msyncs the active segment at a fixed interval, and
+ * unmaps, syncs and trims each full segment to the length actually used.
+ * Until trimmed, the active segment has trailing NUL bytes after the last
+ * record. Segments other than the first begin with the preamble, if one is
+ * set (see LogSink::set_preamble()).
+ */
+class MmapLogSink : public LogSink {
+
+    public:
+        /**
+         * @param prefix            path prefix of segment files
+         * @param segment_size      size of each segment, in bytes
+         * @param sync_interval_ms  interval between msyncs of the active
+         *                          segment, in milliseconds
+         */
+        MmapLogSink(const std::string & prefix,
+                std::size_t segment_size=64 * 1024 * 1024,
+                unsigned long sync_interval_ms=1000)
+            : prefix_(prefix)
+            , segment_size_(segment_size)
+            , sync_interval_(sync_interval_ms)
+            , next_index_(1)
+            , current_(nullptr)
+            , preamble_(nullptr)
+            , stopping_(false) {
+            std::lock_guard<std::mutex> lock(this->mutex_);
+            this->current_.store(this->open_segment_(segment_size), std::memory_order_seq_cst);
+            this->worker_ = std::thread(&MmapLogSink::run_worker_, this);
+        }
+
+        /**
+         * Syncs and trims all segments.
+         */
+        ~MmapLogSink() {
+            {
+                std::lock_guard<std::mutex> lock(this->mutex_);
+                this->stopping_ = true;
+                this->retired_.push_back(this->current_.load());
+            }
+            this->worker_cv_.notify_one();
+            this->worker_.join();
+        }
+
+        MmapLogSink(const MmapLogSink &) = delete;
+        MmapLogSink & operator=(const MmapLogSink &) = delete;
+
+        void append(const char * data, std::size_t size) override {
+            while (true) {
+                Segment * seg = this->current_.load(std::memory_order_seq_cst);
+                seg->writers.fetch_add(1, std::memory_order_seq_cst);
+                if (this->current_.load(std::memory_order_seq_cst) != seg) {
+                    // segment was retired between the two loads: its mapping
+                    // may already be gone
+                    seg->writers.fetch_sub(1, std::memory_order_release);
+                    continue;
+                }
+                std::size_t offset = seg->reserved.fetch_add(size, std::memory_order_relaxed);
+                if (offset + size <= seg->size) {
+                    std::memcpy(seg->base + offset, data, size);
+                    seg->writers.fetch_sub(1, std::memory_order_release);
+                    return;
+                }
+                if (offset <= seg->size) {
+                    // this reservation straddles the end of the segment: the
+                    // segment's data ends where it starts
+                    seg->used.store(offset, std::memory_order_relaxed);
+                }
+                seg->writers.fetch_sub(1, std::memory_order_release);
+                this->advance_(seg, size);
+            }
+        }
+
+        /**
+         * Synchronously msyncs the active segment.
+         */
+        void sync() {
+            this->sync_current_();
+        }
+
+        void set_preamble(LogSink::PreambleWriter writer) override {
+            std::lock_guard<std::mutex> lock(this->mutex_);
+            this->preamble_ = writer;
+        }
+
+    private:
+
+        struct Segment {
+            int                         fd;
+            char *                      base;
+            std::size_t                 size;
+            std::string                 path;
+            std::atomic<std::size_t>    reserved;
+            std::atomic<std::size_t>    used;
+            std::atomic<unsigned>       writers;
+        };
+
+        Segment * open_segment_(std::size_t size) {
+            std::string path;
+            int fd = -1;
+            while (fd < 0) {
+                char suffix[16];
+                std::snprintf(suffix, sizeof(suffix), ".%06lu", this->next_index_++);
+                path = this->prefix_ + suffix;
+                fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+                if (fd < 0 && errno != EEXIST) {
+                    throw std::runtime_error(strerror(errno));
+                }
+            }
+            int err = ::posix_fallocate(fd, 0, static_cast<off_t>(size));
+            if (err != 0) {
+                ::close(fd);
+                throw std::runtime_error(strerror(err));
+            }
+            void * base = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (base == MAP_FAILED) {
+                int mmap_errno = errno;
+                ::close(fd);
+                throw std::runtime_error(strerror(mmap_errno));
+            }
+            std::unique_ptr<Segment> seg(new Segment);
+            seg->fd = fd;
+            seg->base = static_cast<char *>(base);
+            seg->size = size;
+            seg->path = path;
+            seg->reserved.store(0);
+            seg->used.store(size);
+            seg->writers.store(0);
+            this->segments_.push_back(std::move(seg));
+            return this->segments_.back().get();
+        }
+
+        /**
+         * Replaces a full segment with a new one (unless another thread has
+         * already done so) and hands the full one to the background thread.
+         * Segment objects (though not their mappings) are kept for the
+         * lifetime of the sink, since appending threads may still hold
+         * pointers to them.
+         */
+        void advance_(Segment * full, std::size_t record_size) {
+            std::lock_guard<std::mutex> lock(this->mutex_);
+            if (this->current_.load(std::memory_order_seq_cst) != full) {
+                return;
+            }
+            std::string preamble;
+            if (this->preamble_ != nullptr) {
+                this->preamble_(preamble);
+            }
+            std::size_t size = preamble.size() + record_size;
+            if (size < this->segment_size_) {
+                size = this->segment_size_;
+            }
+            Segment * seg = this->open_segment_(size);
+            std::memcpy(seg->base, preamble.data(), preamble.size());
+            seg->reserved.store(preamble.size(), std::memory_order_relaxed);
+            this->current_.store(seg, std::memory_order_seq_cst);
+            this->retired_.push_back(full);
+            this->worker_cv_.notify_one();
+        }
+
+        /**
+         * Msyncs the active segment without holding the lock, so that
+         * threads advancing to a new segment are not held up. The segment
+         * is pinned as for an append, so it cannot be unmapped meanwhile.
+         */
+        void sync_current_() {
+            while (true) {
+                Segment * seg = this->current_.load(std::memory_order_seq_cst);
+                seg->writers.fetch_add(1, std::memory_order_seq_cst);
+                if (this->current_.load(std::memory_order_seq_cst) != seg) {
+                    seg->writers.fetch_sub(1, std::memory_order_release);
+                    continue;
+                }
+                std::size_t reserved = seg->reserved.load(std::memory_order_relaxed);
+                std::size_t length = reserved < seg->size ? reserved : seg->size;
+                if (length > 0) {
+                    ::msync(seg->base, length, MS_SYNC);
+                }
+                seg->writers.fetch_sub(1, std::memory_order_release);
+                return;
+            }
+        }
+
+        /**
+         * Waits for in-flight appends to a retired segment to finish, then
+         * syncs, unmaps and trims it.
+         */
+        static void close_segment_(Segment * seg) {
+            while (seg->writers.load(std::memory_order_seq_cst) != 0) {
+                std::this_thread::yield();
+            }
+            std::size_t reserved = seg->reserved.load(std::memory_order_acquire);
+            std::size_t used = seg->used.load(std::memory_order_relaxed);
+            if (reserved < used) {
+                used = reserved;
+            }
+            ::msync(seg->base, seg->size, MS_SYNC);
+            ::munmap(seg->base, seg->size);
+            seg->base = nullptr;
+            if (::ftruncate(seg->fd, static_cast<off_t>(used)) == 0) {
+                ::fsync(seg->fd);
+            }
+            ::close(seg->fd);
+            seg->fd = -1;
+        }
+
+        void run_worker_() {
+            std::unique_lock<std::mutex> lock(this->mutex_);
+            while (true) {
+                this->worker_cv_.wait_for(lock, std::chrono::milliseconds(this->sync_interval_),
+                        [this] { return this->stopping_ || !this->retired_.empty(); });
+                while (!this->retired_.empty()) {
+                    Segment * seg = this->retired_.front();
+                    this->retired_.pop_front();
+                    lock.unlock();
+                    MmapLogSink::close_segment_(seg);
+                    lock.lock();
+                }
+                if (this->stopping_) {
+                    return;
+                }
+                lock.unlock();
+                this->sync_current_();
+                lock.lock();
+            }
+        }
+
+    private:
+        std::string                             prefix_;
+        std::size_t                             segment_size_;
+        unsigned long                           sync_interval_;
+        unsigned long                           next_index_;
+        std::atomic<Segment *>                  current_;
+        LogSink::PreambleWriter                 preamble_;
+        std::deque<std::unique_ptr<Segment>>    segments_;
+        std::deque<Segment *>                   retired_;
+        std::mutex                              mutex_;
+        std::condition_variable                 worker_cv_;
+        bool                                    stopping_;
+        std::thread                             worker_;
+
+}; // MmapLogSink
+
+} // namespace colugo
+
+#endif
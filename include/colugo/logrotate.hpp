@@ -0,0 +1,370 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright 2013 Jeet Sukumaran.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program. If not, see <http://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+// Requires zlib (link with -lz).
+
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+#include "logger.hpp"
+
+#if !defined(COLUGO_LOGROTATE_HPP)
+#define COLUGO_LOGROTATE_HPP
+
+namespace colugo {
+
+/**
+ * Log sink writing to a file that is rolled over when it reaches a given
+ * size and/or age.
+ *
+ * Rolled segments are kept as <code>path.1[.gz]</code> (most recent)
+ * through <code>path.N[.gz]</code> (oldest); older generations are deleted.
+ * On rollover the logging thread only renames the active file and opens a
+ * fresh one. Shifting generations, gzip compression and the fsync of the
+ * rolled data are all done on a background thread, so logging never waits
+ * on them. A segment that cannot be compressed is kept uncompressed, as
+ * <code>path.N</code>.
+ *
+ * If a fresh file cannot be opened on rollover, records are dropped until
+ * a later append succeeds in opening it.
+ */
+class RotatingFileLogSink : public LogSink {
+
+    public:
+        /**
+         * Opens (creating if necessary) the active log file.
+         *
+         * @param path              path to active log file
+         * @param max_size          roll when file would exceed this many
+         *                          bytes (0 = no size limit)
+         * @param max_age_seconds   roll when file is older than this
+         *                          (0 = no time limit)
+         * @param num_generations   number of rolled segments to keep
+         * @param compress          gzip rolled segments?
+         */
+        RotatingFileLogSink(const std::string & path,
+                std::size_t max_size,
+                unsigned long max_age_seconds=0,
+                unsigned num_generations=5,
+                bool compress=true)
+            : path_(path)
+            , max_size_(max_size)
+            , max_age_(max_age_seconds)
+            , num_generations_(num_generations)
+            , compress_(compress)
+            , fd_(-1)
+            , current_size_(0)
+            , preamble_size_(0)
+            , preamble_(nullptr)
+            , roll_count_(0)
+            , busy_(false)
+            , stopping_(false) {
+            if (!this->open_()) {
+                throw std::runtime_error(strerror(errno));
+            }
+            this->worker_ = std::thread(&RotatingFileLogSink::run_worker_, this);
+        }
+
+        /**
+         * Closes the active file after waiting for pending compression
+         * jobs to finish.
+         */
+        ~RotatingFileLogSink() {
+            {
+                std::lock_guard<std::mutex> lock(this->jobs_mutex_);
+                this->stopping_ = true;
+            }
+            this->jobs_cv_.notify_one();
+            this->worker_.join();
+            if (this->fd_ >= 0) {
+                ::close(this->fd_);
+            }
+        }
+
+        RotatingFileLogSink(const RotatingFileLogSink &) = delete;
+        RotatingFileLogSink & operator=(const RotatingFileLogSink &) = delete;
+
+        void append(const char * data, std::size_t size) override {
+            std::lock_guard<std::mutex> lock(this->mutex_);
+            if (this->fd_ < 0 && !this->open_()) {
+                return;
+            }
+            if (this->should_roll_(size)) {
+                this->roll_();
+                if (this->fd_ < 0) {
+                    return;
+                }
+            }
+            this->write_(data, size);
+        }
+
+        void set_preamble(LogSink::PreambleWriter writer) override {
+            std::lock_guard<std::mutex> lock(this->mutex_);
+            this->preamble_ = writer;
+        }
+
+        /**
+         * Rolls over the active file now, regardless of size or age.
+         */
+        void roll() {
+            std::lock_guard<std::mutex> lock(this->mutex_);
+            this->roll_();
+        }
+
+        /**
+         * Blocks until all rolled segments queued so far have been
+         * compressed and shifted into place.
+         */
+        void wait_for_pending() {
+            std::unique_lock<std::mutex> lock(this->jobs_mutex_);
+            this->idle_cv_.wait(lock, [this] { return this->jobs_.empty() && !this->busy_; });
+        }
+
+    private:
+
+        typedef std::chrono::steady_clock clock_type;
+
+        /**
+         * Opens the active file, starting it with the preamble if it is
+         * empty.
+         *
+         * @return  <code>false</code> (with errno set) if the file could not
+         *          be opened
+         */
+        bool open_() {
+            this->fd_ = ::open(this->path_.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+            if (this->fd_ < 0) {
+                return false;
+            }
+            struct stat st;
+            if (::fstat(this->fd_, &st) == 0) {
+                this->current_size_ = static_cast<std::size_t>(st.st_size);
+            } else {
+                this->current_size_ = 0;
+            }
+            this->preamble_size_ = 0;
+            this->opened_at_ = clock_type::now();
+            if (this->current_size_ == 0 && this->preamble_ != nullptr) {
+                std::string preamble;
+                this->preamble_(preamble);
+                this->write_(preamble.data(), preamble.size());
+                this->preamble_size_ = this->current_size_;
+            }
+            return true;
+        }
+
+        void write_(const char * data, std::size_t size) {
+            if (stream::FdWriter::write_all(this->fd_, data, size)) {
+                this->current_size_ += size;
+                return;
+            }
+            // part of the data may have been written before the error
+            struct stat st;
+            if (::fstat(this->fd_, &st) == 0) {
+                this->current_size_ = static_cast<std::size_t>(st.st_size);
+            }
+        }
+
+        bool should_roll_(std::size_t incoming) const {
+            if (this->current_size_ <= this->preamble_size_) {
+                return false;
+            }
+            if (this->max_size_ > 0 && this->current_size_ + incoming > this->max_size_) {
+                return true;
+            }
+            if (this->max_age_ > 0
+                    && clock_type::now() - this->opened_at_ >= std::chrono::seconds(this->max_age_)) {
+                return true;
+            }
+            return false;
+        }
+
+        void roll_() {
+            std::string rolled = this->path_ + ".rolling."
+                + std::to_string(::getpid()) + "." + std::to_string(this->roll_count_++);
+            ::close(this->fd_);
+            this->fd_ = -1;
+            if (std::rename(this->path_.c_str(), rolled.c_str()) != 0) {
+                // keep appending to the current file
+                this->open_();
+                return;
+            }
+            this->open_();
+            {
+                std::lock_guard<std::mutex> lock(this->jobs_mutex_);
+                this->jobs_.push_back(rolled);
+            }
+            this->jobs_cv_.notify_one();
+        }
+
+        std::string generation_path_(unsigned generation, bool compressed) const {
+            std::string p = this->path_ + "." + std::to_string(generation);
+            if (compressed) {
+                p += ".gz";
+            }
+            return p;
+        }
+
+        /**
+         * Moves a generation (compressed or not, whichever exists) to
+         * another.
+         */
+        void shift_generation_(unsigned from, unsigned to) const {
+            std::rename(this->generation_path_(from, false).c_str(), this->generation_path_(to, false).c_str());
+            if (this->compress_) {
+                std::rename(this->generation_path_(from, true).c_str(), this->generation_path_(to, true).c_str());
+            }
+        }
+
+        void run_worker_() {
+            std::unique_lock<std::mutex> lock(this->jobs_mutex_);
+            while (true) {
+                this->jobs_cv_.wait(lock, [this] { return this->stopping_ || !this->jobs_.empty(); });
+                if (this->jobs_.empty()) {
+                    return;
+                }
+                std::string rolled = this->jobs_.front();
+                this->jobs_.pop_front();
+                this->busy_ = true;
+                lock.unlock();
+                this->retire_(rolled);
+                lock.lock();
+                this->busy_ = false;
+                if (this->jobs_.empty()) {
+                    this->idle_cv_.notify_all();
+                }
+            }
+        }
+
+        void retire_(const std::string & rolled) {
+            if (this->num_generations_ == 0) {
+                std::remove(rolled.c_str());
+                return;
+            }
+            std::remove(this->generation_path_(this->num_generations_, false).c_str());
+            std::remove(this->generation_path_(this->num_generations_, true).c_str());
+            for (unsigned g = this->num_generations_ - 1; g > 0; --g) {
+                this->shift_generation_(g, g + 1);
+            }
+            if (!this->compress_) {
+                RotatingFileLogSink::sync_file_(rolled);
+                std::rename(rolled.c_str(), this->generation_path_(1, false).c_str());
+                return;
+            }
+            std::string dest = this->generation_path_(1, true);
+            std::string tmp = dest + ".tmp";
+            if (RotatingFileLogSink::gzip_file_(rolled, tmp)) {
+                std::rename(tmp.c_str(), dest.c_str());
+                std::remove(rolled.c_str());
+            } else {
+                // keep the segment uncompressed rather than lose it
+                std::remove(tmp.c_str());
+                RotatingFileLogSink::sync_file_(rolled);
+                std::rename(rolled.c_str(), this->generation_path_(1, false).c_str());
+            }
+        }
+
+        /**
+         * Flushes a rolled segment that is kept as it is to disk.
+         */
+        static void sync_file_(const std::string & path) {
+            int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd < 0) {
+                return;
+            }
+            ::fsync(fd);
+            ::close(fd);
+        }
+
+        static bool gzip_file_(const std::string & src_path, const std::string & dest_path) {
+            int src = ::open(src_path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (src < 0) {
+                return false;
+            }
+            int dest = ::open(dest_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            if (dest < 0) {
+                ::close(src);
+                return false;
+            }
+            int gz_fd = ::dup(dest);
+            gzFile gz = gz_fd >= 0 ? gzdopen(gz_fd, "wb6") : nullptr;
+            if (gz == nullptr && gz_fd >= 0) {
+                ::close(gz_fd);
+            }
+            bool ok = gz != nullptr;
+            char buffer[1 << 16];
+            while (ok) {
+                ssize_t n = ::read(src, buffer, sizeof(buffer));
+                if (n < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (n <= 0) {
+                    ok = n == 0;
+                    break;
+                }
+                ok = gzwrite(gz, buffer, static_cast<unsigned>(n)) == n;
+            }
+            if (gz != nullptr && gzclose(gz) != Z_OK) {
+                ok = false;
+            }
+            if (ok && ::fsync(dest) != 0) {
+                ok = false;
+            }
+            ::close(dest);
+            ::close(src);
+            return ok;
+        }
+
+    private:
+        std::string                 path_;
+        std::size_t                 max_size_;
+        unsigned long               max_age_;
+        unsigned                    num_generations_;
+        bool                        compress_;
+        std::mutex                  mutex_;
+        int                         fd_;
+        std::size_t                 current_size_;
+        std::size_t                 preamble_size_;
+        LogSink::PreambleWriter     preamble_;
+        clock_type::time_point      opened_at_;
+        unsigned long               roll_count_;
+        std::mutex                  jobs_mutex_;
+        std::condition_variable     jobs_cv_;
+        std::condition_variable     idle_cv_;
+        std::deque<std::string>     jobs_;
+        bool                        busy_;
+        bool                        stopping_;
+        std::thread                 worker_;
+
+}; // RotatingFileLogSink
+
+} // namespace colugo
+
+#endif
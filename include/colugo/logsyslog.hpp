@@ -0,0 +1,315 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright 2013 Jeet Sukumaran.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program. If not, see <http://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <deque>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "logger.hpp"
+
+#if !defined(COLUGO_LOGSYSLOG_HPP)
+#define COLUGO_LOGSYSLOG_HPP
+
+namespace colugo {
+
+/**
+ * Log sink sending records to the local syslog daemon (or journald) over
+ * a Unix datagram socket.
+ *
+ * Each record becomes one datagram in the traditional local syslog
+ * format:
+ *
+ *      <PRI>Mmm dd HH:MM:SS ident[pid]: record
+ *
+ * with the severity in PRI derived from the record's logging level.
+ * Logging never blocks on the socket: append() queues the datagram, and a
+ * background thread sends queued datagrams in batches with a single
+ * sendmmsg(2) call on a non-blocking socket. When the daemon falls behind,
+ * the background thread waits for the socket to accept more and retries,
+ * while further records queue up. Records are dropped, and counted, when
+ * the queue is full, when the socket fails, or when the daemon still is
+ * not accepting datagrams a second after the sink starts shutting down.
+ */
+class SyslogLogSink : public LogSink {
+
+    public:
+        /**
+         * @param ident         program name tagging each record
+         * @param facility      syslog facility code (e.g., 1 for "user",
+         *                      16-23 for "local0"-"local7")
+         * @param path          path of the local syslog socket
+         * @param max_queued    records queued before further records are
+         *                      dropped
+         * @param batch_size    maximum records sent per system call
+         */
+        SyslogLogSink(const std::string & ident,
+                int facility=1,
+                const std::string & path="/dev/log",
+                std::size_t max_queued=4096,
+                std::size_t batch_size=64)
+            : tag_(ident + "[" + std::to_string(::getpid()) + "]: ")
+            , facility_(facility)
+            , path_(path)
+            , max_queued_(max_queued)
+            , batch_size_(batch_size > 0 ? batch_size : 1)
+            , fd_(-1)
+            , num_dropped_(0)
+            , stopping_(false)
+            , shutdown_stalled_(false) {
+            if (!this->connect_()) {
+                throw std::runtime_error(strerror(errno));
+            }
+            this->worker_ = std::thread(&SyslogLogSink::run_worker_, this);
+        }
+
+        /**
+         * Sends any records still queued.
+         */
+        ~SyslogLogSink() {
+            {
+                std::lock_guard<std::mutex> lock(this->mutex_);
+                this->stopping_ = true;
+            }
+            this->queue_cv_.notify_one();
+            this->worker_.join();
+            if (this->fd_ >= 0) {
+                ::close(this->fd_);
+            }
+        }
+
+        SyslogLogSink(const SyslogLogSink &) = delete;
+        SyslogLogSink & operator=(const SyslogLogSink &) = delete;
+
+        void append(const char * data, std::size_t size) override {
+            this->append_at_level(static_cast<int>(Logger::LoggingLevel::NOTSET), data, size);
+        }
+
+        void append_at_level(int level, const char * data, std::size_t size) override {
+            if (size > 0 && data[size - 1] == '\n') {
+                --size;
+            }
+            char header[64];
+            std::size_t header_size = this->format_header_(level, header, sizeof(header));
+            {
+                std::lock_guard<std::mutex> lock(this->mutex_);
+                if (this->queue_.size() >= this->max_queued_) {
+                    this->num_dropped_.fetch_add(1, std::memory_order_relaxed);
+                    return;
+                }
+                this->queue_.emplace_back();
+                std::string & datagram = this->queue_.back();
+                datagram.reserve(header_size + this->tag_.size() + size);
+                datagram.append(header, header_size);
+                datagram += this->tag_;
+                datagram.append(data, size);
+            }
+            this->queue_cv_.notify_one();
+        }
+
+        /**
+         * Returns the number of records dropped so far, because the queue
+         * was full or the socket failed.
+         */
+        unsigned long num_dropped() const {
+            return this->num_dropped_.load(std::memory_order_relaxed);
+        }
+
+        /**
+         * Returns the syslog severity (0-7) corresponding to a logging
+         * level.
+         *
+         * @param level     logging level (as Logger::LoggingLevel)
+         * @return          syslog severity
+         */
+        static int severity(int level) {
+            if (level >= static_cast<int>(Logger::LoggingLevel::CRITICAL)) {
+                return 2;   // LOG_CRIT
+            } else if (level >= static_cast<int>(Logger::LoggingLevel::ERROR)) {
+                return 3;   // LOG_ERR
+            } else if (level >= static_cast<int>(Logger::LoggingLevel::WARNING)) {
+                return 4;   // LOG_WARNING
+            } else if (level >= static_cast<int>(Logger::LoggingLevel::INFO)
+                    || level == static_cast<int>(Logger::LoggingLevel::NOTSET)) {
+                return 6;   // LOG_INFO
+            }
+            return 7;       // LOG_DEBUG
+        }
+
+    private:
+
+        bool connect_() {
+            if (this->fd_ >= 0) {
+                ::close(this->fd_);
+            }
+            this->fd_ = ::socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+            if (this->fd_ < 0) {
+                return false;
+            }
+            struct sockaddr_un addr;
+            std::memset(&addr, 0, sizeof(addr));
+            addr.sun_family = AF_UNIX;
+            std::strncpy(addr.sun_path, this->path_.c_str(), sizeof(addr.sun_path) - 1);
+            if (::connect(this->fd_, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) != 0) {
+                int connect_errno = errno;
+                ::close(this->fd_);
+                this->fd_ = -1;
+                errno = connect_errno;
+                return false;
+            }
+            return true;
+        }
+
+        std::size_t format_header_(int level, char * header, std::size_t size) const {
+            std::time_t now = std::time(nullptr);
+            std::tm local_tm;
+            localtime_r(&now, &local_tm);
+            char timestamp[20];
+            std::strftime(timestamp, sizeof(timestamp), "%b %e %H:%M:%S", &local_tm);
+            int n = std::snprintf(header, size, "<%d>%s ",
+                    this->facility_ * 8 + SyslogLogSink::severity(level), timestamp);
+            return n < 0 ? 0 : static_cast<std::size_t>(n) < size ? static_cast<std::size_t>(n) : size - 1;
+        }
+
+        /**
+         * Sends a batch of datagrams, waiting for the socket to accept them
+         * while it would block. Datagrams are dropped (and counted) only
+         * if the socket fails, or if it would still block after
+         * SHUTDOWN_WAIT_MS once the sink is stopping.
+         */
+        void send_batch_(std::vector<std::string> & batch) {
+            std::vector<struct mmsghdr> messages(batch.size());
+            std::vector<struct iovec> iovecs(batch.size());
+            for (std::size_t i = 0; i < batch.size(); ++i) {
+                iovecs[i].iov_base = &batch[i][0];
+                iovecs[i].iov_len = batch[i].size();
+                std::memset(&messages[i], 0, sizeof(messages[i]));
+                messages[i].msg_hdr.msg_iov = &iovecs[i];
+                messages[i].msg_hdr.msg_iovlen = 1;
+            }
+            std::size_t sent = 0;
+            bool reconnected = false;
+            while (sent < batch.size()) {
+                int n = this->fd_ < 0 ? -1 : ::sendmmsg(this->fd_, &messages[sent],
+                        static_cast<unsigned>(batch.size() - sent), MSG_DONTWAIT | MSG_NOSIGNAL);
+                if (n > 0) {
+                    sent += static_cast<std::size_t>(n);
+                    continue;
+                }
+                if (n < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) && !this->shutdown_stalled_) {
+                    // the daemon is behind: keep the batch until it catches
+                    // up, but check now and then whether to give up
+                    bool stopping = this->is_stopping_();
+                    struct pollfd pfd;
+                    pfd.fd = this->fd_;
+                    pfd.events = POLLOUT;
+                    pfd.revents = 0;
+                    int ready = ::poll(&pfd, 1, stopping ? SHUTDOWN_WAIT_MS : RETRY_WAIT_MS);
+                    if (ready != 0 || !stopping) {
+                        continue;
+                    }
+                    // drop whatever is left rather than wait again for each
+                    // batch
+                    this->shutdown_stalled_ = true;
+                    errno = EAGAIN;
+                }
+                if (n < 0 && !reconnected && (this->fd_ < 0 || errno == ECONNREFUSED || errno == ENOTCONN)) {
+                    // daemon restarted: try once to reach the new socket
+                    reconnected = true;
+                    if (this->connect_()) {
+                        continue;
+                    }
+                }
+                if (n < 0 && (errno == EMSGSIZE || errno == ENOBUFS)) {
+                    // only this datagram is at fault
+                    this->num_dropped_.fetch_add(1, std::memory_order_relaxed);
+                    sent += 1;
+                    continue;
+                }
+                this->num_dropped_.fetch_add(batch.size() - sent, std::memory_order_relaxed);
+                break;
+            }
+        }
+
+        bool is_stopping_() {
+            std::lock_guard<std::mutex> lock(this->mutex_);
+            return this->stopping_;
+        }
+
+        void run_worker_() {
+            std::vector<std::string> batch;
+            std::unique_lock<std::mutex> lock(this->mutex_);
+            while (true) {
+                this->queue_cv_.wait(lock, [this] { return this->stopping_ || !this->queue_.empty(); });
+                if (this->queue_.empty()) {
+                    return;
+                }
+                std::size_t n = this->queue_.size() < this->batch_size_ ? this->queue_.size() : this->batch_size_;
+                batch.clear();
+                for (std::size_t i = 0; i < n; ++i) {
+                    batch.push_back(std::move(this->queue_[i]));
+                }
+                this->queue_.erase(this->queue_.begin(), this->queue_.begin() + static_cast<std::ptrdiff_t>(n));
+                lock.unlock();
+                this->send_batch_(batch);
+                lock.lock();
+            }
+        }
+
+    private:
+        static constexpr int RETRY_WAIT_MS = 100;
+        static constexpr int SHUTDOWN_WAIT_MS = 1000;
+
+    private:
+        std::string                 tag_;
+        int                         facility_;
+        std::string                 path_;
+        std::size_t                 max_queued_;
+        std::size_t                 batch_size_;
+        int                         fd_;
+        std::atomic<unsigned long>  num_dropped_;
+        std::deque<std::string>     queue_;
+        std::mutex                  mutex_;
+        std::condition_variable     queue_cv_;
+        bool                        stopping_;
+        // set (by the worker only) once the daemon has not accepted
+        // datagrams for SHUTDOWN_WAIT_MS after the sink started stopping
+        bool                        shutdown_stalled_;
+        std::thread                 worker_;
+
+}; // SyslogLogSink
+
+} // namespace colugo
+
+#endif
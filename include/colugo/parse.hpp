@@ -0,0 +1,301 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright 2013 Jeet Sukumaran.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program. If not, see <http://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <string_view>
+#include <system_error>
+#include <type_traits>
+
+#if !defined(COLUGO_PARSE_HPP)
+#define COLUGO_PARSE_HPP
+
+namespace colugo {
+namespace textutil {
+
+/**
+ * Outcome of parsing a number.
+ */
+enum class ParseError {
+    NONE = 0,
+    EMPTY,                  // no characters
+    INVALID,                // not a number
+    OUT_OF_RANGE,           // a number, but not representable in the type
+    TRAILING_CHARACTERS,    // a number followed by other characters
+};
+
+/**
+ * Returns a description of a parse error.
+ */
+inline const char * parse_error_message(ParseError error) {
+    switch (error) {
+        case ParseError::NONE:                  return "no error";
+        case ParseError::EMPTY:                 return "empty value";
+        case ParseError::INVALID:               return "not a number";
+        case ParseError::OUT_OF_RANGE:          return "value out of range";
+        case ParseError::TRAILING_CHARACTERS:   return "unexpected characters after number";
+    }
+    return "unknown error";
+}
+
+/**
+ * Value of a parse, with its outcome; converts to <code>true</code> on
+ * success.
+ */
+template <typename T>
+struct ParseResult {
+    T           value;
+    ParseError  error;
+
+    explicit operator bool() const {
+        return this->error == ParseError::NONE;
+    }
+};
+
+/**
+ * Types parse() accepts: integers (other than bool and the character
+ * types) and floating point types.
+ */
+template <typename T>
+constexpr bool is_parseable() {
+    return (std::is_integral<T>::value
+                && !std::is_same<T, bool>::value
+                && !std::is_same<T, char>::value
+                && !std::is_same<T, signed char>::value
+                && !std::is_same<T, unsigned char>::value)
+        || std::is_floating_point<T>::value;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Fixed-width digit runs
+//
+// Runs of up to 16 decimal digits are validated and converted eight at a
+// time as 64-bit words (SIMD within a register), instead of one digit at a
+// time.
+
+/**
+ * Converts exactly eight digit characters, or returns <code>false</code>
+ * if any of them is not a digit.
+ */
+inline bool parse_eight_digits(const char * p, std::uint64_t & value) {
+    std::uint64_t word;
+    std::memcpy(&word, p, sizeof(word));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    word = __builtin_bswap64(word);
+#endif
+    // every byte in 0x30-0x39
+    if ((word & 0xF0F0F0F0F0F0F0F0ULL) != 0x3030303030303030ULL
+            || ((word + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL) != 0x3030303030303030ULL) {
+        return false;
+    }
+    word -= 0x3030303030303030ULL;
+    // combine adjacent digits, then pairs, then quads
+    word = (word * 10) + (word >> 8);
+    word = (((word & 0x000000FF000000FFULL) * (100 + (1000000ULL << 32)))
+            + (((word >> 16) & 0x000000FF000000FFULL) * (1 + (10000ULL << 32)))) >> 32;
+    value = word;
+    return true;
+}
+
+/**
+ * Converts a run of 1 to 16 digit characters, or returns
+ * <code>false</code> if any of them is not a digit.
+ */
+inline bool parse_digits(const char * p, std::size_t size, std::uint64_t & value) {
+    char padded[8];
+    std::uint64_t high = 0;
+    std::uint64_t low = 0;
+    if (size > 8) {
+        std::size_t num_high = size - 8;
+        std::memset(padded, '0', sizeof(padded));
+        std::memcpy(padded + 8 - num_high, p, num_high);
+        if (!parse_eight_digits(padded, high) || !parse_eight_digits(p + num_high, low)) {
+            return false;
+        }
+        value = high * 100000000ULL + low;
+        return true;
+    }
+    std::memset(padded, '0', sizeof(padded));
+    std::memcpy(padded + 8 - size, p, size);
+    return parse_eight_digits(padded, value);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Single values
+
+/**
+ * Parses a number occupying all of <code>s</code>, with std::from_chars
+ * (and so independent of locale). A leading '+' is accepted; leading or
+ * trailing whitespace is not. Integers are decimal; floating point values
+ * may be in fixed or scientific notation, or "inf" or "nan".
+ *
+ * @param s         text to parse
+ * @param value     set to the parsed value on success
+ * @return          ParseError::NONE on success, otherwise the reason for
+ *                  failure (and <code>value</code> is unchanged)
+ */
+template <typename T>
+inline ParseError parse(std::string_view s, T & value) {
+    static_assert(is_parseable<T>(), "parse() requires an integer or floating point type");
+    if (s.empty()) {
+        return ParseError::EMPTY;
+    }
+    const char * begin = s.data();
+    const char * end = begin + s.size();
+    if (*begin == '+' && s.size() > 1 && begin[1] != '-') {
+        ++begin;
+    }
+    if constexpr (std::is_integral<T>::value) {
+        // fast path for up to 16 digits; anything else (including
+        // negative values of unsigned types) goes to std::from_chars
+        bool negative = std::is_signed<T>::value && *begin == '-';
+        const char * digits = negative ? begin + 1 : begin;
+        std::size_t num_digits = static_cast<std::size_t>(end - digits);
+        std::uint64_t magnitude = 0;
+        if (num_digits > 0 && num_digits <= 16 && parse_digits(digits, num_digits, magnitude)) {
+            typedef typename std::make_unsigned<T>::type U;
+            std::uint64_t max_magnitude = static_cast<U>(std::numeric_limits<T>::max());
+            if (negative) {
+                max_magnitude += 1;
+            }
+            if (magnitude > max_magnitude) {
+                return ParseError::OUT_OF_RANGE;
+            }
+            value = negative
+                ? static_cast<T>(static_cast<U>(0) - static_cast<U>(magnitude))
+                : static_cast<T>(magnitude);
+            return ParseError::NONE;
+        }
+    }
+    T parsed;
+    std::from_chars_result result = std::from_chars(begin, end, parsed);
+    if (result.ec == std::errc::invalid_argument) {
+        return ParseError::INVALID;
+    } else if (result.ec == std::errc::result_out_of_range) {
+        return ParseError::OUT_OF_RANGE;
+    } else if (result.ptr != end) {
+        return ParseError::TRAILING_CHARACTERS;
+    }
+    value = parsed;
+    return ParseError::NONE;
+}
+
+/**
+ * Parses a number occupying all of <code>s</code>, as above.
+ *
+ *      auto count = textutil::parse<unsigned long>(field);
+ *      if (!count) {
+ *          console::abort("bad count: ", textutil::parse_error_message(count.error));
+ *      }
+ *
+ * @param s         text to parse
+ * @return          parsed value (zero on failure) and outcome
+ */
+template <typename T>
+inline ParseResult<T> parse(std::string_view s) {
+    ParseResult<T> result{T(), ParseError::NONE};
+    result.error = parse(s, result.value);
+    return result;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Columns
+
+/**
+ * Outcome of parsing a column.
+ */
+struct ParseColumnResult {
+    std::size_t     num_values;     // values stored
+    ParseError      error;          // reason for stopping early, if any
+    std::size_t     line;           // line (0-based) at which an error occurred
+
+    explicit operator bool() const {
+        return this->error == ParseError::NONE;
+    }
+};
+
+/**
+ * Parses one column of delimited text (e.g., a TSV or CSV buffer) into a
+ * preallocated array, without allocating or copying. Lines are separated
+ * by '\n' (a trailing '\r' is ignored), and empty lines are skipped.
+ * Parsing stops at the first line whose field cannot be parsed (or is
+ * missing), at the end of the buffer, or when the array is full.
+ *
+ * @param buffer        delimited text
+ * @param delimiter     field separator
+ * @param column        index (0-based) of field to parse on each line
+ * @param values        destination array
+ * @param max_values    size of destination array
+ * @return              number of values stored, and any error
+ */
+template <typename T>
+inline ParseColumnResult parse_column(std::string_view buffer,
+        char delimiter,
+        std::size_t column,
+        T * values,
+        std::size_t max_values) {
+    ParseColumnResult result{0, ParseError::NONE, 0};
+    const char * pos = buffer.data();
+    const char * end = pos + buffer.size();
+    for (std::size_t line = 0; pos < end && result.num_values < max_values; ++line) {
+        const char * line_end = static_cast<const char *>(std::memchr(pos, '\n', static_cast<std::size_t>(end - pos)));
+        const char * next = line_end == nullptr ? end : line_end + 1;
+        if (line_end == nullptr) {
+            line_end = end;
+        }
+        if (line_end > pos && line_end[-1] == '\r') {
+            --line_end;
+        }
+        if (line_end == pos) {
+            pos = next;
+            continue;
+        }
+        const char * field = pos;
+        for (std::size_t i = 0; i < column && field != nullptr; ++i) {
+            const char * sep = static_cast<const char *>(std::memchr(field, delimiter, static_cast<std::size_t>(line_end - field)));
+            field = sep == nullptr ? nullptr : sep + 1;
+        }
+        if (field == nullptr) {
+            result.error = ParseError::EMPTY;
+            result.line = line;
+            return result;
+        }
+        const char * field_end = static_cast<const char *>(std::memchr(field, delimiter, static_cast<std::size_t>(line_end - field)));
+        if (field_end == nullptr) {
+            field_end = line_end;
+        }
+        ParseError error = parse(std::string_view(field, static_cast<std::size_t>(field_end - field)),
+                values[result.num_values]);
+        if (error != ParseError::NONE) {
+            result.error = error;
+            result.line = line;
+            return result;
+        }
+        result.num_values += 1;
+        pos = next;
+    }
+    return result;
+}
+
+} // namespace textutil
+} // namespace colugo
+
+#endif
@@ -20,40 +20,942 @@
 #ifndef COLUGO_STREAM_HPP
 #define COLUGO_STREAM_HPP
 
+#include <atomic>
+#include <cerrno>
+#include <charconv>
+#include <climits>
+#include <cstdint>
+#include <cstring>
 #include <ctime>
 #include <iostream>
+#include <iterator>
+#include <locale>
+#include <mutex>
+#include <stdexcept>
+#include <streambuf>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <sys/uio.h>
+#include <unistd.h>
 
 namespace colugo { namespace stream {
 
-inline void write(std::ostream & out) {}
+/**
+ * Stream buffer that appends everything written through it to a
+ * caller-owned std::string. Lets code format with the usual ostream
+ * insertion operators directly into a reusable string, without the copy
+ * made by std::ostringstream::str().
+ */
+class StringAppendBuf : public std::streambuf {
 
+    public:
+        explicit StringAppendBuf(std::string * dest=nullptr)
+            : dest_(dest) {
+        }
+
+        /**
+         * Redirects subsequent output to a different string.
+         * @param dest  string to which characters will be appended
+         */
+        void set_destination(std::string * dest) {
+            this->dest_ = dest;
+        }
+
+    protected:
+        int_type overflow(int_type c) override {
+            if (!traits_type::eq_int_type(c, traits_type::eof())) {
+                this->dest_->push_back(traits_type::to_char_type(c));
+            }
+            return traits_type::not_eof(c);
+        }
+
+        std::streamsize xsputn(const char * s, std::streamsize n) override {
+            this->dest_->append(s, static_cast<std::size_t>(n));
+            return n;
+        }
+
+    private:
+        std::string *   dest_;
+
+}; // StringAppendBuf
+
+/**
+ * Gathers output segments for a file descriptor and writes them with as
+ * few writev(2) calls as possible, retrying on EINTR and resuming after
+ * short writes.
+ *
+ * Segments added with add() are referenced, not copied: the caller must
+ * keep them alive until the next flush(). Segments added with add_copy()
+ * (and single characters) are copied into storage owned by the writer.
+ * Pending segments are written out by flush() and on destruction.
+ *
+ *      stream::FdWriter writer(STDOUT_FILENO);
+ *      writer.add(header);
+ *      writer.add(body);
+ *      writer.add('\n');
+ *      writer.flush();
+ */
+class FdWriter {
+
+    public:
+#if defined(IOV_MAX)
+        static constexpr std::size_t MAX_IOVECS = IOV_MAX;
+#else
+        static constexpr std::size_t MAX_IOVECS = 1024;
+#endif
+
+        /**
+         * @param fd    file descriptor to write to
+         */
+        explicit FdWriter(int fd)
+            : fd_(fd) {
+        }
+
+        ~FdWriter() {
+            this->flush();
+        }
+
+        FdWriter(const FdWriter &) = delete;
+        FdWriter & operator=(const FdWriter &) = delete;
+
+        /**
+         * Adds a reference to caller-owned data, which must remain valid
+         * until the next flush().
+         */
+        void add(std::string_view s) {
+            if (!s.empty()) {
+                this->segments_.push_back(Segment{s.data(), 0, s.size()});
+            }
+        }
+
+        /**
+         * Adds a copy of <code>s</code>.
+         */
+        void add_copy(std::string_view s) {
+            if (s.empty()) {
+                return;
+            }
+            Segment * last = this->segments_.empty() ? nullptr : &this->segments_.back();
+            if (last != nullptr && last->data == nullptr && last->offset + last->size == this->owned_.size()) {
+                // extends the previous copied segment
+                last->size += s.size();
+            } else {
+                this->segments_.push_back(Segment{nullptr, this->owned_.size(), s.size()});
+            }
+            this->owned_.append(s.data(), s.size());
+        }
+
+        /**
+         * Adds a copy of a single character.
+         */
+        void add(char c) {
+            this->add_copy(std::string_view(&c, 1));
+        }
+
+        /**
+         * Returns the number of bytes waiting to be written.
+         */
+        std::size_t size() const {
+            std::size_t total = 0;
+            for (const Segment & segment : this->segments_) {
+                total += segment.size;
+            }
+            return total;
+        }
+
+        /**
+         * Writes out all pending segments.
+         *
+         * @return  <code>false</code> if the descriptor could not be written
+         *          to (pending segments are discarded either way)
+         */
+        bool flush() {
+            if (this->segments_.empty()) {
+                return true;
+            }
+            this->iovecs_.resize(this->segments_.size());
+            for (std::size_t i = 0; i < this->segments_.size(); ++i) {
+                const Segment & segment = this->segments_[i];
+                const char * data = segment.data != nullptr ? segment.data : this->owned_.data() + segment.offset;
+                this->iovecs_[i].iov_base = const_cast<char *>(data);
+                this->iovecs_[i].iov_len = segment.size;
+            }
+            bool ok = FdWriter::write_all(this->fd_, this->iovecs_.data(), this->iovecs_.size());
+            this->segments_.clear();
+            this->owned_.clear();
+            return ok;
+        }
+
+        /**
+         * Writes all of <code>iov</code> to <code>fd</code>, at most
+         * MAX_IOVECS entries per writev(2) call. The iovec entries are
+         * modified.
+         *
+         * @param fd        file descriptor to write to
+         * @param iov       segments to write
+         * @param count     number of segments
+         * @return          <code>false</code> on a write error other than
+         *                  EINTR
+         */
+        static bool write_all(int fd, struct iovec * iov, std::size_t count) {
+            while (count > 0) {
+                if (iov->iov_len == 0) {
+                    ++iov;
+                    --count;
+                    continue;
+                }
+                int batch = static_cast<int>(count < MAX_IOVECS ? count : MAX_IOVECS);
+                ssize_t n = ::writev(fd, iov, batch);
+                if (n < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    return false;
+                }
+                // skip what was written, resuming within a partly written
+                // segment after a short write
+                std::size_t written = static_cast<std::size_t>(n);
+                while (count > 0 && written >= iov->iov_len) {
+                    written -= iov->iov_len;
+                    ++iov;
+                    --count;
+                }
+                if (written > 0) {
+                    iov->iov_base = static_cast<char *>(iov->iov_base) + written;
+                    iov->iov_len -= written;
+                }
+            }
+            return true;
+        }
+
+        /**
+         * Writes all of a single buffer to <code>fd</code>.
+         *
+         * @param fd        file descriptor to write to
+         * @param data      data to write
+         * @param size      number of bytes
+         * @return          <code>false</code> on a write error other than
+         *                  EINTR
+         */
+        static bool write_all(int fd, const char * data, std::size_t size) {
+            struct iovec iov;
+            iov.iov_base = const_cast<char *>(data);
+            iov.iov_len = size;
+            return FdWriter::write_all(fd, &iov, 1);
+        }
+
+    private:
+        // data is nullptr for copied segments, which are located by offset
+        // since the owned storage may be reallocated as it grows
+        struct Segment {
+            const char *    data;
+            std::size_t     offset;
+            std::size_t     size;
+        };
+
+    private:
+        int                         fd_;
+        std::vector<Segment>        segments_;
+        std::string                 owned_;
+        std::vector<struct iovec>   iovecs_;
+
+}; // FdWriter
+
+/**
+ * Fully-buffered stream buffer writing to a file descriptor. The buffer
+ * is written out (with write(2), retrying on EINTR and short writes) only
+ * when it fills up or the stream is flushed. No put area is exposed to
+ * std::streambuf, so every output operation goes through overflow() or
+ * xsputn(), which are serialized with a mutex: a single instance can back
+ * a stream shared by several threads. Characters written one at a time
+ * (e.g., by formatted numeric output) each take the lock, so output is
+ * best passed in whole strings.
+ */
+class FdStreamBuf : public std::streambuf {
+
+    public:
+        /**
+         * @param fd            file descriptor to write to
+         * @param buffer_size   size of buffer, in bytes
+         */
+        FdStreamBuf(int fd, std::size_t buffer_size)
+            : fd_(fd)
+            , buffer_(buffer_size > 0 ? buffer_size : 1)
+            , used_(0) {
+        }
+
+        ~FdStreamBuf() {
+            this->sync();
+        }
+
+        FdStreamBuf(const FdStreamBuf &) = delete;
+        FdStreamBuf & operator=(const FdStreamBuf &) = delete;
+
+    protected:
+        int_type overflow(int_type c) override {
+            if (traits_type::eq_int_type(c, traits_type::eof())) {
+                return traits_type::not_eof(c);
+            }
+            std::lock_guard<std::mutex> lock(this->mutex_);
+            this->buffer_[this->used_++] = traits_type::to_char_type(c);
+            if (this->used_ == this->buffer_.size() && !this->flush_()) {
+                return traits_type::eof();
+            }
+            return c;
+        }
+
+        std::streamsize xsputn(const char * s, std::streamsize n) override {
+            std::lock_guard<std::mutex> lock(this->mutex_);
+            std::size_t size = static_cast<std::size_t>(n);
+            if (size > this->buffer_.size() - this->used_) {
+                if (size >= this->buffer_.size()) {
+                    // buffered data and the new data go out together
+                    struct iovec iov[2];
+                    iov[0].iov_base = this->buffer_.data();
+                    iov[0].iov_len = this->used_;
+                    iov[1].iov_base = const_cast<char *>(s);
+                    iov[1].iov_len = size;
+                    this->used_ = 0;
+                    return FdWriter::write_all(this->fd_, iov, 2) ? n : 0;
+                }
+                if (!this->flush_()) {
+                    return 0;
+                }
+            }
+            std::memcpy(this->buffer_.data() + this->used_, s, size);
+            this->used_ += size;
+            return n;
+        }
+
+        int sync() override {
+            std::lock_guard<std::mutex> lock(this->mutex_);
+            return this->flush_() ? 0 : -1;
+        }
+
+    private:
+        bool flush_() {
+            bool ok = FdWriter::write_all(this->fd_, this->buffer_.data(), this->used_);
+            this->used_ = 0;
+            return ok;
+        }
+
+    private:
+        int                 fd_;
+        std::vector<char>   buffer_;
+        std::size_t         used_;
+        std::mutex          mutex_;
+
+}; // FdStreamBuf
+
+///////////////////////////////////////////////////////////////////////////////
+// Buffer
+
+/**
+ * Fixed-size output buffer that formats values directly into contiguous
+ * storage: integers and floating point values with std::to_chars, strings
+ * with memcpy. The contents are written to the destination stream or file
+ * descriptor in a single call when the buffer fills up, when flushed, and
+ * on destruction.
+ *
+ * Values are formatted as a std::ostream in its default state (decimal,
+ * precision 6, no width, "C" locale) would format them; use
+ * has_default_format() to check that a stream is in that state. A Buffer
+ * is also a stream buffer, so anything else can be formatted into it
+ * through a std::ostream.
+ */
+class Buffer : public std::streambuf {
+
+    public:
+        static const std::size_t CAPACITY = 1024;
+
+        explicit Buffer(std::ostream & out)
+            : out_(&out)
+            , fd_(-1)
+            , size_(0) {
+        }
+
+        explicit Buffer(int fd)
+            : out_(nullptr)
+            , fd_(fd)
+            , size_(0) {
+        }
+
+        ~Buffer() {
+            this->flush();
+        }
+
+        Buffer(const Buffer &) = delete;
+        Buffer & operator=(const Buffer &) = delete;
+
+        /**
+         * Writes out the contents of the buffer.
+         */
+        void flush() {
+            if (this->size_ > 0) {
+                this->write_out_(this->data_, this->size_);
+                this->size_ = 0;
+            }
+        }
+
+        void append(const char * s, std::size_t n) {
+            if (n > CAPACITY - this->size_) {
+                this->flush();
+                if (n > CAPACITY) {
+                    this->write_out_(s, n);
+                    return;
+                }
+            }
+            std::memcpy(this->data_ + this->size_, s, n);
+            this->size_ += n;
+        }
+
+        void append(char c) {
+            if (this->size_ == CAPACITY) {
+                this->flush();
+            }
+            this->data_[this->size_++] = c;
+        }
+
+        /**
+         * True for types formatted by put() without an ostream.
+         */
+        template <typename T>
+        static constexpr bool is_formattable() {
+            return std::is_arithmetic<T>::value
+                || std::is_same<T, std::string>::value
+                || std::is_same<T, std::string_view>::value
+                || std::is_same<T, const char *>::value
+                || std::is_same<T, char *>::value
+                || (std::is_array<T>::value && std::is_same<typename std::remove_cv<typename std::remove_extent<T>::type>::type, char>::value);
+        }
+
+        /**
+         * Formats a value into the buffer. <code>T</code> must satisfy
+         * is_formattable(); C strings must not be null.
+         */
+        template <typename T>
+        void put(const T & value) {
+            if constexpr (std::is_same<T, bool>::value) {
+                this->append(value ? '1' : '0');
+            } else if constexpr (std::is_same<T, char>::value
+                    || std::is_same<T, signed char>::value
+                    || std::is_same<T, unsigned char>::value) {
+                this->append(static_cast<char>(value));
+            } else if constexpr (std::is_integral<T>::value) {
+                this->reserve_(24);
+                auto result = std::to_chars(this->data_ + this->size_, this->data_ + CAPACITY, value);
+                this->size_ = static_cast<std::size_t>(result.ptr - this->data_);
+            } else if constexpr (std::is_floating_point<T>::value) {
+                this->reserve_(64);
+                auto result = std::to_chars(this->data_ + this->size_, this->data_ + CAPACITY, value, std::chars_format::general, 6);
+                this->size_ = static_cast<std::size_t>(result.ptr - this->data_);
+            } else if constexpr (std::is_same<T, std::string>::value || std::is_same<T, std::string_view>::value) {
+                this->append(value.data(), value.size());
+            } else {
+                const char * s = value;
+                this->append(s, std::strlen(s));
+            }
+        }
+
+        /**
+         * Returns <code>true</code> if values written to <code>out</code>
+         * would be formatted exactly as put() formats them.
+         */
+        static bool has_default_format(const std::ostream & out) {
+            const std::ios_base::fmtflags format_flags = std::ios_base::adjustfield
+                | std::ios_base::basefield
+                | std::ios_base::floatfield
+                | std::ios_base::boolalpha
+                | std::ios_base::showbase
+                | std::ios_base::showpoint
+                | std::ios_base::showpos
+                | std::ios_base::uppercase;
+            std::ios_base::fmtflags flags = out.flags() & format_flags;
+            return (flags == std::ios_base::dec || flags == (std::ios_base::dec | std::ios_base::right) || flags == 0)
+                && out.width() == 0
+                && out.precision() == 6;
+        }
+
+    protected:
+        int_type overflow(int_type c) override {
+            if (!traits_type::eq_int_type(c, traits_type::eof())) {
+                this->append(traits_type::to_char_type(c));
+            }
+            return traits_type::not_eof(c);
+        }
+
+        std::streamsize xsputn(const char * s, std::streamsize n) override {
+            this->append(s, static_cast<std::size_t>(n));
+            return n;
+        }
+
+    private:
+        void reserve_(std::size_t n) {
+            if (CAPACITY - this->size_ < n) {
+                this->flush();
+            }
+        }
+
+        void write_out_(const char * s, std::size_t n) {
+            if (this->out_ != nullptr) {
+                this->out_->write(s, static_cast<std::streamsize>(n));
+                return;
+            }
+            FdWriter::write_all(this->fd_, s, n);
+        }
+
+    private:
+        std::ostream *  out_;
+        int             fd_;
+        std::size_t     size_;
+        char            data_[CAPACITY];
+
+}; // Buffer
+
+///////////////////////////////////////////////////////////////////////////////
+// Writing
+
+template <typename T>
+struct is_vector : public std::false_type {
+};
+
+template <typename T, typename A>
+struct is_vector<std::vector<T, A>> : public std::true_type {
+};
+
+/**
+ * Wraps a range (any type with begin() and end()) to be written with a
+ * particular separator and, optionally, only its first
+ * <code>max_items</code> elements followed by a count of the rest (see
+ * range()).
+ */
+template <typename R>
+struct RangeView {
+    const R &           items;
+    std::string_view    separator;
+    std::size_t         max_items;
+};
+
+/**
+ * Writes a range with a given separator, e.g.:
+ *
+ *      colugo::console::out_ln(colugo::stream::range(values, " ", 5));
+ *
+ * writes "1 2 3 4 5 ... 49,999,995 more" for a 50M element vector. Ranges
+ * passed directly to write() use ", " and are never truncated. Elements
+ * that are pairs (e.g., of a map) are written as "key:value".
+ *
+ * @param items         range to write
+ * @param separator     written between elements
+ * @param max_items     maximum number of elements written (0 for all)
+ * @return              range view to pass to write()
+ */
+template <typename R>
+inline RangeView<R> range(const R & items, std::string_view separator=", ", std::size_t max_items=0) {
+    return RangeView<R>{items, separator, max_items};
+}
+
+/**
+ * Arrays of char, signed char or unsigned char, which are written as
+ * null-terminated strings rather than element by element.
+ */
 template <typename T>
-inline void write(std::ostream & out, const std::vector<T> & arg1) {
-    for (unsigned long idx = 0; idx < arg1.size(); ++idx) {
-        if (idx > 0) {
-            out << ", ";
+struct is_character_array : public std::integral_constant<bool, std::is_array<T>::value
+        && (std::is_same<typename std::remove_cv<typename std::remove_extent<T>::type>::type, char>::value
+            || std::is_same<typename std::remove_cv<typename std::remove_extent<T>::type>::type, signed char>::value
+            || std::is_same<typename std::remove_cv<typename std::remove_extent<T>::type>::type, unsigned char>::value)> {
+};
+
+template <typename T, typename Enable=void>
+struct is_range : public std::false_type {
+};
+
+template <typename T>
+struct is_range<T, std::void_t<decltype(std::begin(std::declval<const T &>())),
+        decltype(std::end(std::declval<const T &>()))>>
+    : public std::integral_constant<bool, !is_character_array<T>::value> {
+};
+
+template <typename T, typename Enable=void>
+struct is_streamable : public std::false_type {
+};
+
+template <typename T>
+struct is_streamable<T, std::void_t<decltype(std::declval<std::ostream &>() << std::declval<const T &>())>>
+    : public std::true_type {
+};
+
+/**
+ * Ranges whose elements are numbers stored contiguously, which are
+ * formatted in bulk.
+ */
+template <typename T, typename Enable=void>
+struct is_contiguous_numeric_range : public std::false_type {
+};
+
+template <typename T>
+struct is_contiguous_numeric_range<T, std::void_t<decltype(std::data(std::declval<const T &>())),
+        decltype(std::size(std::declval<const T &>()))>>
+    : public std::is_arithmetic<typename std::remove_cv<typename std::remove_pointer<
+            decltype(std::data(std::declval<const T &>()))>::type>::type> {
+};
+
+template <typename T>
+inline void write_arg(Buffer & buffer, std::ostream & out, bool & fast, const T & arg);
+
+template <typename K, typename V>
+inline void write_arg(Buffer & buffer, std::ostream & out, bool & fast, const std::pair<K, V> & arg);
+
+template <typename R>
+inline void write_arg(Buffer & buffer, std::ostream & out, bool & fast, const RangeView<R> & arg);
+
+/**
+ * Formats one argument of write(): into the buffer if possible, otherwise
+ * (e.g., user-defined types, manipulators, or a stream with non-default
+ * formatting) through the stream's own insertion operator, after flushing
+ * the buffer so that output stays in order. Ranges without an insertion
+ * operator of their own (and vectors) are written element by element.
+ */
+template <typename T>
+inline void write_arg(Buffer & buffer, std::ostream & out, bool & fast, const T & arg) {
+    if constexpr (!Buffer::is_formattable<T>()
+            && is_range<T>::value
+            && (!is_streamable<T>::value || is_vector<T>::value || std::is_array<T>::value)) {
+        write_arg(buffer, out, fast, RangeView<T>{arg, ", ", 0});
+    } else {
+        if constexpr (Buffer::is_formattable<T>()) {
+            if constexpr (std::is_pointer<T>::value) {
+                if (fast && arg != nullptr) {
+                    buffer.put(arg);
+                    return;
+                }
+            } else {
+                if (fast) {
+                    buffer.put(arg);
+                    return;
+                }
+            }
         }
-        out << arg1[idx];
+        if (out.rdbuf() != &buffer) {
+            buffer.flush();
+        }
+        out << arg;
+        fast = Buffer::has_default_format(out);
     }
 }
 
+template <typename K, typename V>
+inline void write_arg(Buffer & buffer, std::ostream & out, bool & fast, const std::pair<K, V> & arg) {
+    write_arg(buffer, out, fast, arg.first);
+    write_arg(buffer, out, fast, ':');
+    write_arg(buffer, out, fast, arg.second);
+}
+
+/**
+ * Writes the "... N more" note ending a truncated range, with the count
+ * in groups of three digits.
+ */
+inline void write_num_more(Buffer & buffer, std::ostream & out, bool & fast, std::string_view separator, std::size_t num_more) {
+    char digits[32];
+    auto result = std::to_chars(digits, digits + sizeof(digits), num_more);
+    std::size_t num_digits = static_cast<std::size_t>(result.ptr - digits);
+    std::string text(separator);
+    text += "... ";
+    for (std::size_t i = 0; i < num_digits; ++i) {
+        if (i > 0 && (num_digits - i) % 3 == 0) {
+            text += ',';
+        }
+        text += digits[i];
+    }
+    text += " more";
+    write_arg(buffer, out, fast, text);
+}
+
+/**
+ * Formats numbers from contiguous storage straight into large chunks,
+ * with no per-element dispatch, writing each chunk out in one call.
+ */
 template <typename T>
-inline void write(std::ostream & out, const T& arg1) {
-    out << arg1;
+inline void write_numbers(Buffer & buffer, const T * values, std::size_t count, std::string_view separator) {
+    const std::size_t chunk_size = 16384;
+    const std::size_t max_value_size = 64;
+    char chunk[chunk_size];
+    std::size_t pos = 0;
+    for (std::size_t i = 0; i < count; ++i) {
+        if (pos + separator.size() + max_value_size > chunk_size) {
+            buffer.append(chunk, pos);
+            pos = 0;
+        }
+        if (i > 0) {
+            if (separator.size() + max_value_size > chunk_size) {
+                buffer.append(chunk, pos);
+                buffer.append(separator.data(), separator.size());
+                pos = 0;
+            } else {
+                std::memcpy(chunk + pos, separator.data(), separator.size());
+                pos += separator.size();
+            }
+        }
+        if constexpr (std::is_same<T, bool>::value) {
+            chunk[pos++] = values[i] ? '1' : '0';
+        } else if constexpr (std::is_same<T, char>::value
+                || std::is_same<T, signed char>::value
+                || std::is_same<T, unsigned char>::value) {
+            chunk[pos++] = static_cast<char>(values[i]);
+        } else if constexpr (std::is_integral<T>::value) {
+            pos = static_cast<std::size_t>(std::to_chars(chunk + pos, chunk + chunk_size, values[i]).ptr - chunk);
+        } else {
+            pos = static_cast<std::size_t>(std::to_chars(chunk + pos, chunk + chunk_size, values[i], std::chars_format::general, 6).ptr - chunk);
+        }
+    }
+    buffer.append(chunk, pos);
+}
+
+template <typename R>
+inline void write_arg(Buffer & buffer, std::ostream & out, bool & fast, const RangeView<R> & arg) {
+    if constexpr (is_contiguous_numeric_range<R>::value) {
+        if (fast) {
+            std::size_t size = std::size(arg.items);
+            std::size_t count = arg.max_items > 0 && arg.max_items < size ? arg.max_items : size;
+            write_numbers(buffer, std::data(arg.items), count, arg.separator);
+            if (count < size) {
+                write_num_more(buffer, out, fast, count > 0 ? arg.separator : std::string_view(), size - count);
+            }
+            return;
+        }
+    }
+    std::size_t count = 0;
+    auto iter = std::begin(arg.items);
+    auto end = std::end(arg.items);
+    for (; iter != end; ++iter, ++count) {
+        if (arg.max_items > 0 && count == arg.max_items) {
+            break;
+        }
+        if (count > 0) {
+            write_arg(buffer, out, fast, arg.separator);
+        }
+        write_arg(buffer, out, fast, *iter);
+    }
+    if (iter != end) {
+        write_num_more(buffer, out, fast, count > 0 ? arg.separator : std::string_view(),
+                static_cast<std::size_t>(std::distance(iter, end)));
+    }
+}
+
+inline void write(std::ostream &) {}
+
+/**
+ * Writes each argument to <code>out</code>, as <code>out << arg</code>
+ * would. Strings and numbers are formatted into a local buffer, which is
+ * written to the stream in a single call; other arguments go through the
+ * stream's insertion operators.
+ */
+template <typename... Types>
+inline void write(std::ostream & out, const Types&... args) {
+    Buffer buffer(out);
+    bool fast = out.getloc() == std::locale::classic() && Buffer::has_default_format(out);
+    (write_arg(buffer, out, fast, args), ...);
+}
+
+/**
+ * Writes each argument to a file descriptor, formatted as write() formats
+ * it for a stream in its default state, with a single write(2) call per
+ * buffer-full.
+ */
+template <typename... Types>
+inline void write_fd(int fd, const Types&... args) {
+    // arguments that cannot be formatted directly go through a stream
+    // writing into the same buffer
+    thread_local std::ostream fallback_out(nullptr);
+    Buffer buffer(fd);
+    fallback_out.rdbuf(&buffer);
+    fallback_out.flags(std::ios_base::dec | std::ios_base::skipws);
+    fallback_out.precision(6);
+    fallback_out.width(0);
+    fallback_out.fill(' ');
+    bool fast = true;
+    (write_arg(buffer, fallback_out, fast, args), ...);
+    fallback_out.rdbuf(nullptr);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Compiled format strings
+
+/**
+ * A format string with "{}" placeholders (and "{{", "}}" for literal
+ * braces), parsed when it is constructed into the literal pieces between
+ * placeholders. Meant to be built at compile time through COLUGO_FMT, so
+ * that a malformed format string is a compile-time error and no parsing
+ * happens at run time.
+ */
+template <std::size_t N>
+class FormatString {
+
+    public:
+        constexpr FormatString(const char (&format)[N])
+            : text_{}
+            , piece_offset_{}
+            , piece_size_{}
+            , num_fields_(0) {
+            std::size_t out = 0;
+            std::size_t piece_start = 0;
+            for (std::size_t i = 0; i + 1 < N; ++i) {
+                char c = format[i];
+                if (c == '{' && i + 2 < N && format[i + 1] == '{') {
+                    this->text_[out++] = '{';
+                    ++i;
+                } else if (c == '}' && i + 2 < N && format[i + 1] == '}') {
+                    this->text_[out++] = '}';
+                    ++i;
+                } else if (c == '{') {
+                    if (i + 2 >= N || format[i + 1] != '}') {
+                        throw std::logic_error("format string: '{' must be followed by '}' or '{'");
+                    }
+                    this->piece_offset_[this->num_fields_] = piece_start;
+                    this->piece_size_[this->num_fields_] = out - piece_start;
+                    ++this->num_fields_;
+                    piece_start = out;
+                    ++i;
+                } else if (c == '}') {
+                    throw std::logic_error("format string: unmatched '}'");
+                } else {
+                    this->text_[out++] = c;
+                }
+            }
+            this->piece_offset_[this->num_fields_] = piece_start;
+            this->piece_size_[this->num_fields_] = out - piece_start;
+        }
+
+        /** Number of "{}" placeholders. */
+        constexpr std::size_t num_fields() const {
+            return this->num_fields_;
+        }
+
+        /**
+         * Literal text preceding placeholder <code>idx</code> (or, for
+         * <code>idx == num_fields()</code>, following the last one).
+         */
+        std::string_view piece(std::size_t idx) const {
+            return std::string_view(this->text_ + this->piece_offset_[idx], this->piece_size_[idx]);
+        }
+
+    private:
+        char            text_[N];
+        std::size_t     piece_offset_[N];
+        std::size_t     piece_size_[N];
+        std::size_t     num_fields_;
+
+}; // FormatString
+
+/**
+ * Identifier given to a compiled format string by code that keeps a table
+ * of formats (as binary log channels do, see logbinary.hpp); 0 until one
+ * is assigned. COLUGO_FMT creates one per format string.
+ */
+struct FormatSlot {
+    std::atomic<std::uint32_t>  id{0};
+};
+
+/**
+ * Handle to a compile-time FormatString, carrying the number of
+ * placeholders in its type so that argument counts can be checked at
+ * compile time. Produced by COLUGO_FMT.
+ */
+template <std::size_t N, std::size_t NumFields>
+struct CompiledFormat {
+    const FormatString<N> & format;
+    FormatSlot &            slot;
+};
+
+/**
+ * A compiled format together with its arguments (see fmt()). Written by
+ * write() (and hence by console output functions and Logger) in a single
+ * pass, with literal pieces and arguments going straight into the output
+ * buffer.
+ */
+template <std::size_t N, typename... Types>
+struct Formatted {
+    const FormatString<N> &         format;
+    FormatSlot &                    slot;
+    std::tuple<const Types&...>     args;
+};
+
+/**
+ * Binds arguments to a compiled format string, e.g.:
+ *
+ *      colugo::console::out_ln(colugo::stream::fmt(COLUGO_FMT("x={} y={}"), x, y));
+ *      log.info(colugo::stream::fmt(COLUGO_FMT("read {} rows in {} s"), n, t));
+ *
+ * The result refers to the arguments rather than copying them, so it must
+ * be used within the same full expression.
+ */
+template <std::size_t N, std::size_t NumFields, typename... Types>
+inline Formatted<N, Types...> fmt(const CompiledFormat<N, NumFields> & format, const Types&... args) {
+    static_assert(NumFields == sizeof...(Types), "number of arguments does not match number of '{}' placeholders");
+    return Formatted<N, Types...>{format.format, format.slot, std::tuple<const Types&...>(args...)};
 }
 
-template <typename T, typename... Types>
-inline void write(std::ostream & out, const T& arg1, const Types&... args) {
-    out << arg1;
-    write(out, args...);
+template <std::size_t N, typename... Types, std::size_t... Indexes>
+inline void write_formatted(Buffer & buffer,
+        std::ostream & out,
+        bool & fast,
+        const Formatted<N, Types...> & formatted,
+        std::index_sequence<Indexes...>) {
+    ((write_arg(buffer, out, fast, formatted.format.piece(Indexes)),
+      write_arg(buffer, out, fast, std::get<Indexes>(formatted.args))), ...);
+    write_arg(buffer, out, fast, formatted.format.piece(sizeof...(Types)));
 }
 
-template <typename T, typename... Types>
-inline void write(std::ostream & out, const std::vector<T> & arg1, const Types&... args) {
-    write(out, arg1);
-    write(out, args...);
+template <std::size_t N, typename... Types>
+inline void write_arg(Buffer & buffer, std::ostream & out, bool & fast, const Formatted<N, Types...> & formatted) {
+    write_formatted(buffer, out, fast, formatted, std::index_sequence_for<Types...>());
+}
+
+template <std::size_t N, typename... Types>
+inline std::ostream & operator<<(std::ostream & out, const Formatted<N, Types...> & formatted) {
+    write(out, formatted);
+    return out;
+}
+
+/**
+ * Writes a compiled format string with its arguments to a stream.
+ */
+template <std::size_t N, std::size_t NumFields, typename... Types>
+inline void format(std::ostream & out, const CompiledFormat<N, NumFields> & format, const Types&... args) {
+    write(out, fmt(format, args...));
+}
+
+/**
+ * Returns a compiled format string with its arguments as a string, e.g.,
+ * for exception messages:
+ *
+ *      throw std::runtime_error(colugo::stream::format_string(COLUGO_FMT("bad value '{}' on line {}"), value, line));
+ */
+template <std::size_t N, std::size_t NumFields, typename... Types>
+inline std::string format_string(const CompiledFormat<N, NumFields> & format, const Types&... args) {
+    std::string result;
+    StringAppendBuf buf(&result);
+    std::ostream out(&buf);
+    write(out, fmt(format, args...));
+    return result;
 }
 
 } } // colugo::stream
 
+/**
+ * Compiles a string literal with "{}" placeholders into a
+ * colugo::stream::CompiledFormat. The string is parsed at compile time;
+ * malformed format strings fail to compile.
+ */
+#define COLUGO_FMT(s) \
+    ([]() { \
+        static constexpr colugo::stream::FormatString<sizeof(s)> colugo_format_(s); \
+        static colugo::stream::FormatSlot colugo_format_slot_; \
+        return colugo::stream::CompiledFormat<sizeof(s), colugo_format_.num_fields()>{colugo_format_, colugo_format_slot_}; \
+    }())
+
 #endif
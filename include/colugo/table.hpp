@@ -0,0 +1,251 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright 2013 Jeet Sukumaran.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program. If not, see <http://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <iterator>
+#include <locale>
+#include <mutex>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include "stream.hpp"
+
+#if !defined(COLUGO_TABLE_HPP)
+#define COLUGO_TABLE_HPP
+
+namespace colugo { namespace stream {
+
+/**
+ * Writes large tables, given as columns, formatting blocks of rows on
+ * several threads at once.
+ *
+ * Each column is a contiguous sequence (a std::vector, std::array, C
+ * array, etc.) with one element per row. Row <code>i</code> is written
+ * exactly as
+ *
+ *      stream::write(out, col1[i], sep, col2[i], sep, ..., coln[i], '\n');
+ *
+ * would write it. Disjoint blocks of rows are formatted into per-thread
+ * buffers by worker threads and written to the stream in order by the
+ * calling thread, so the output is byte-for-byte the same as writing the
+ * rows serially. At most two blocks per thread are held in memory at a
+ * time.
+ *
+ *      stream::TableWriter table(std::cout);
+ *      table.write(ids, scores, names);
+ *
+ * Element types with their own insertion operators are formatted on the
+ * worker threads, so those operators must be safe to call concurrently.
+ */
+class TableWriter {
+
+    public:
+        /**
+         * @param out           destination stream (its formatting state is
+         *                      used to format every row)
+         * @param num_threads   formatting threads (0: one per hardware
+         *                      thread; 1: format on the calling thread)
+         * @param block_rows    rows formatted per block
+         * @param separator     written between columns
+         */
+        TableWriter(std::ostream & out,
+                unsigned num_threads=0,
+                std::size_t block_rows=8192,
+                const std::string & separator="\t")
+            : out_(out)
+            , num_threads_(num_threads > 0 ? num_threads : std::thread::hardware_concurrency())
+            , block_rows_(block_rows > 0 ? block_rows : 1)
+            , separator_(separator) {
+            if (this->num_threads_ == 0) {
+                this->num_threads_ = 1;
+            }
+        }
+
+        /**
+         * Writes one line per row.
+         *
+         * @param columns   columns of the table, all of the same length
+         */
+        template <typename... Columns>
+        void write(const Columns&... columns) {
+            static_assert(sizeof...(Columns) > 0, "table must have at least one column");
+            std::size_t sizes[] = {static_cast<std::size_t>(std::size(columns))...};
+            std::size_t num_rows = sizes[0];
+            for (std::size_t size : sizes) {
+                if (size != num_rows) {
+                    throw std::runtime_error("table columns have different lengths");
+                }
+            }
+            std::size_t num_blocks = (num_rows + this->block_rows_ - 1) / this->block_rows_;
+            if (this->num_threads_ == 1 || num_blocks <= 1) {
+                std::string text;
+                for (std::size_t block = 0; block < num_blocks; ++block) {
+                    text.clear();
+                    this->format_block_(text, this->out_, block, num_rows, columns...);
+                    this->out_.write(text.data(), static_cast<std::streamsize>(text.size()));
+                }
+                return;
+            }
+            this->write_parallel_(num_blocks, num_rows, columns...);
+        }
+
+    private:
+
+        /**
+         * Formats one block of rows into <code>text</code>, with the
+         * formatting state of <code>format</code>.
+         */
+        template <typename... Columns>
+        void format_block_(std::string & text,
+                const std::ios & format,
+                std::size_t block,
+                std::size_t num_rows,
+                const Columns&... columns) const {
+            StringAppendBuf text_buf(&text);
+            std::ostream text_out(&text_buf);
+            text_out.copyfmt(format);
+            text_out.tie(nullptr);
+            text_out.exceptions(std::ios_base::goodbit);
+            Buffer buffer(text_out);
+            bool fast_format = text_out.getloc() == std::locale::classic() && Buffer::has_default_format(text_out);
+            std::size_t begin = block * this->block_rows_;
+            std::size_t end = begin + this->block_rows_ < num_rows ? begin + this->block_rows_ : num_rows;
+            std::string_view separator(this->separator_);
+            for (std::size_t row = begin; row < end; ++row) {
+                // as if each row were a separate call to stream::write()
+                bool fast = fast_format;
+                std::size_t column = 0;
+                ((column++ > 0 ? write_arg(buffer, text_out, fast, separator) : void(),
+                  write_arg(buffer, text_out, fast, std::data(columns)[row])), ...);
+                write_arg(buffer, text_out, fast, '\n');
+            }
+        }
+
+        template <typename... Columns>
+        void write_parallel_(std::size_t num_blocks, std::size_t num_rows, const Columns&... columns) {
+            struct Slot {
+                std::string         text;
+                bool                ready = false;
+            };
+            std::size_t num_slots = 2 * static_cast<std::size_t>(this->num_threads_);
+            std::vector<Slot> slots(num_slots);
+            std::mutex mutex;
+            std::condition_variable ready_cv;
+            std::condition_variable free_cv;
+            std::atomic<std::size_t> next_block(0);
+            std::size_t num_written = 0;
+            bool stopping = false;
+            std::exception_ptr error;
+
+            // workers copy the destination's formatting state from here,
+            // not from the destination itself, which is being written to
+            std::string unused;
+            StringAppendBuf format_buf(&unused);
+            std::ostream format(&format_buf);
+            format.copyfmt(this->out_);
+
+            auto format_blocks = [&]() {
+                while (true) {
+                    std::size_t block = next_block.fetch_add(1, std::memory_order_relaxed);
+                    if (block >= num_blocks) {
+                        return;
+                    }
+                    Slot & slot = slots[block % num_slots];
+                    {
+                        // wait until the slot's previous block has been written
+                        std::unique_lock<std::mutex> lock(mutex);
+                        free_cv.wait(lock, [&] { return stopping || block < num_written + num_slots; });
+                        if (stopping) {
+                            return;
+                        }
+                    }
+                    slot.text.clear();
+                    std::exception_ptr block_error;
+                    try {
+                        this->format_block_(slot.text, format, block, num_rows, columns...);
+                    } catch (...) {
+                        block_error = std::current_exception();
+                    }
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if (block_error && !error) {
+                        error = block_error;
+                    }
+                    slot.ready = true;
+                    ready_cv.notify_all();
+                }
+            };
+
+            std::vector<std::thread> workers;
+            std::exception_ptr write_error;
+            try {
+                for (unsigned i = 0; i < this->num_threads_; ++i) {
+                    workers.emplace_back(format_blocks);
+                }
+                for (std::size_t block = 0; block < num_blocks; ++block) {
+                    Slot & slot = slots[block % num_slots];
+                    {
+                        std::unique_lock<std::mutex> lock(mutex);
+                        ready_cv.wait(lock, [&] { return slot.ready || error; });
+                        if (error) {
+                            break;
+                        }
+                    }
+                    // no worker touches a ready slot until it is released below
+                    this->out_.write(slot.text.data(), static_cast<std::streamsize>(slot.text.size()));
+                    std::lock_guard<std::mutex> lock(mutex);
+                    slot.ready = false;
+                    num_written = block + 1;
+                    free_cv.notify_all();
+                }
+            } catch (...) {
+                // e.g., the stream throws on failure: workers must still be
+                // stopped and joined
+                write_error = std::current_exception();
+            }
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
+            }
+            free_cv.notify_all();
+            for (auto & worker : workers) {
+                worker.join();
+            }
+            if (write_error) {
+                std::rethrow_exception(write_error);
+            }
+            if (error) {
+                std::rethrow_exception(error);
+            }
+        }
+
+    private:
+        std::ostream &  out_;
+        unsigned        num_threads_;
+        std::size_t     block_rows_;
+        std::string     separator_;
+
+}; // TableWriter
+
+} } // colugo::stream
+
+#endif
@@ -17,11 +17,18 @@
 //
 ///////////////////////////////////////////////////////////////////////////////
 
+#include <cctype>
+#include <cstddef>
+#include <cstdint>
 #include <ctime>
+#include <iterator>
+#include <streambuf>
 #include <string>
+#include <string_view>
 #include <sstream>
 #include <vector>
 #include <algorithm>
+#include "charscan.hpp"
 
 #if !defined(COLUGO_TEXTUTIL_HPP)
 #define COLUGO_TEXTUTIL_HPP
@@ -29,6 +36,41 @@
 namespace colugo {
 namespace textutil {
 
+/**
+ * Returns a view of the given string with specified characters stripped
+ * from beginning and end, without copying.
+ *
+ * @param s         source string
+ * @param to_trim   characters to remove
+ * @return          view of source without specified characters at
+ *                  beginning and end
+ */
+inline std::string_view trim_view(std::string_view s, std::string_view to_trim=" \t\n\r") {
+    std::size_t start = s.find_first_not_of(to_trim);
+    if (start == std::string_view::npos) {
+        return std::string_view();
+    }
+    std::size_t end = s.find_last_not_of(to_trim);
+    return s.substr(start, end-start+1);
+}
+
+/**
+ * Strips specified characters from beginning and end of a string, in
+ * place.
+ *
+ * @param s         string to trim
+ * @param to_trim   characters to remove
+ */
+inline void trim_in_place(std::string & s, std::string_view to_trim=" \t\n\r") {
+    std::size_t end = s.find_last_not_of(to_trim);
+    if (end == std::string::npos) {
+        s.clear();
+        return;
+    }
+    s.erase(end + 1);
+    s.erase(0, s.find_first_not_of(to_trim));
+}
+
 /**
  * Returns copy of given string with specified characters stripped from
  * beginning and end.
@@ -39,18 +81,95 @@ namespace textutil {
  *                  beginning and end
  */
 inline std::string trim(const std::string & s, const std::string & to_trim=" \t\n\r") {
-    if (!s.empty()) {
-        std::size_t start = s.find_first_not_of(to_trim);
-        if (start == std::string::npos) {
-            return "";
+    return std::string(trim_view(s, to_trim));
+}
+
+/**
+ * Converts characters to lower (<code>to_upper=false</code>) or upper
+ * case, in place. Blocks of ASCII characters are converted 16 at a time
+ * with vector instructions where available; any other characters go
+ * through std::tolower/std::toupper (and so the current C locale).
+ *
+ * @param data      characters to convert
+ * @param size      number of characters
+ * @param to_upper  convert to upper case?
+ */
+inline void convert_case_in_place(char * data, std::size_t size, bool to_upper) {
+    std::size_t i = 0;
+#if defined(COLUGO_CHARSCAN_X86)
+    // letters to change are 'A'-'Z' (lowering) or 'a'-'z' (raising); case
+    // differs only in bit 0x20
+    const __m128i first = _mm_set1_epi8(static_cast<char>((to_upper ? 'a' : 'A') - 1));
+    const __m128i last = _mm_set1_epi8(static_cast<char>((to_upper ? 'z' : 'Z') + 1));
+    const __m128i case_bit = _mm_set1_epi8(0x20);
+#endif
+    while (i < size) {
+#if defined(COLUGO_CHARSCAN_X86)
+        for (; i + 16 <= size; i += 16) {
+            __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+            if (_mm_movemask_epi8(bytes) != 0) {
+                break;
+            }
+            __m128i is_letter = _mm_and_si128(_mm_cmpgt_epi8(bytes, first), _mm_cmplt_epi8(bytes, last));
+            bytes = _mm_xor_si128(bytes, _mm_and_si128(is_letter, case_bit));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(data + i), bytes);
+        }
+#endif
+        // a block with non-ASCII characters, or the tail
+        std::size_t block_end = size - i < 16 ? size : i + 16;
+        for (; i < block_end; ++i) {
+            unsigned char c = static_cast<unsigned char>(data[i]);
+            if (c >= 0x80) {
+                data[i] = static_cast<char>(to_upper ? std::toupper(c) : std::tolower(c));
+            } else if (to_upper ? (c >= 'a' && c <= 'z') : (c >= 'A' && c <= 'Z')) {
+                data[i] = static_cast<char>(c ^ 0x20);
+            }
         }
-        std::size_t end = s.find_last_not_of(to_trim);
-        return s.substr(start, end-start+1);
-    } else {
-        return s;
     }
 }
 
+/**
+ * Converts a string to lower case, in place.
+ *
+ * @param s         string to convert
+ */
+inline void lower_in_place(std::string & s) {
+    convert_case_in_place(&s[0], s.size(), false);
+}
+
+/**
+ * Converts a string to upper case, in place.
+ *
+ * @param s         string to convert
+ */
+inline void upper_in_place(std::string & s) {
+    convert_case_in_place(&s[0], s.size(), true);
+}
+
+/**
+ * Writes the lower case form of a string to a caller-owned string, which
+ * can be reused to avoid allocating.
+ *
+ * @param s         source string
+ * @param dest      destination (contents are replaced)
+ */
+inline void lower_into(std::string_view s, std::string & dest) {
+    dest.assign(s.data(), s.size());
+    lower_in_place(dest);
+}
+
+/**
+ * Writes the upper case form of a string to a caller-owned string, which
+ * can be reused to avoid allocating.
+ *
+ * @param s         source string
+ * @param dest      destination (contents are replaced)
+ */
+inline void upper_into(std::string_view s, std::string & dest) {
+    dest.assign(s.data(), s.size());
+    upper_in_place(dest);
+}
+
 /**
  * Converts a string to lower case.
  *
@@ -59,7 +178,7 @@ inline std::string trim(const std::string & s, const std::string & to_trim=" \t\
  */
 inline std::string lower(const std::string & s) {
     std::string result = s;
-    std::transform(s.begin(), s.end(), result.begin(), (int(*)(int))std::tolower);
+    lower_in_place(result);
     return result;
 }
 
@@ -71,7 +190,7 @@ inline std::string lower(const std::string & s) {
  */
 inline std::string upper(const std::string & s) {
     std::string result = s;
-    std::transform(s.begin(), s.end(), result.begin(), (int(*)(int))std::toupper);
+    upper_in_place(result);
     return result;
 }
 
@@ -89,12 +208,293 @@ inline bool startswith(const std::string & s1, const std::string & s2) {
 }
 
 /**
- * Wraps a line of text to specified width.
+ * Returns the number of terminal columns taken up by a Unicode code point:
+ * 2 for East Asian wide and fullwidth characters (and emoji), 0 for
+ * combining marks and other zero-width characters, and 1 otherwise.
+ *
+ * @param cp    code point
+ * @return      display width, in columns
+ */
+inline unsigned display_width(char32_t cp) {
+    static const char32_t zero_width[][2] = {
+        {0x0300, 0x036F}, {0x0483, 0x0489}, {0x0591, 0x05BD}, {0x0610, 0x061A},
+        {0x064B, 0x065F}, {0x0E31, 0x0E31}, {0x0E34, 0x0E3A}, {0x0E47, 0x0E4E},
+        {0x1AB0, 0x1AFF}, {0x1DC0, 0x1DFF}, {0x200B, 0x200F}, {0x2028, 0x202E},
+        {0x2060, 0x2064}, {0x20D0, 0x20FF}, {0xFE00, 0xFE0F}, {0xFE20, 0xFE2F},
+        {0xFEFF, 0xFEFF}, {0xE0100, 0xE01EF},
+    };
+    static const char32_t wide[][2] = {
+        {0x1100, 0x115F}, {0x231A, 0x231B}, {0x2329, 0x232A}, {0x23E9, 0x23EC},
+        {0x2614, 0x2615}, {0x2E80, 0x303E}, {0x3041, 0x33FF}, {0x3400, 0x4DBF},
+        {0x4E00, 0x9FFF}, {0xA000, 0xA4CF}, {0xA960, 0xA97F}, {0xAC00, 0xD7A3},
+        {0xF900, 0xFAFF}, {0xFE10, 0xFE19}, {0xFE30, 0xFE6F}, {0xFF00, 0xFF60},
+        {0xFFE0, 0xFFE6}, {0x16FE0, 0x16FE4}, {0x17000, 0x18AFF}, {0x1B000, 0x1B2FF},
+        {0x1F300, 0x1F64F}, {0x1F680, 0x1F6FF}, {0x1F900, 0x1F9FF}, {0x1FA70, 0x1FAFF},
+        {0x20000, 0x2FFFD}, {0x30000, 0x3FFFD},
+    };
+    if (cp < 0x0300) {
+        return 1;
+    }
+    for (const auto & range : zero_width) {
+        if (cp >= range[0] && cp <= range[1]) {
+            return 0;
+        }
+    }
+    for (const auto & range : wide) {
+        if (cp >= range[0] && cp <= range[1]) {
+            return 2;
+        }
+    }
+    return 1;
+}
+
+/**
+ * Stream buffer that wraps text as it is written, passing each completed
+ * line on to another stream buffer (or appending it to a string). Only
+ * the current line is held, and the last break candidate (space) in it is
+ * tracked as characters arrive, so arbitrarily long text is wrapped in a
+ * single pass with memory proportional to the line width. Call finish()
+ * after the last character to write out the final (partial) line.
+ *
+ * Text is taken to be UTF-8: columns are counted in display width (see
+ * display_width()), and multi-byte characters are never split. Bytes that
+ * are not valid UTF-8 count as one column each.
+ */
+class WrappingStreamBuf : public std::streambuf {
+
+    public:
+        /**
+         * @param  dest                     stream buffer receiving wrapped text
+         * @param  line_width               width of wrapping
+         * @param  first_line_indent        amount to indent first line
+         * @param  subsequent_line_indent   amount to indent remaining lines
+         *                                  (a hanging indent, if greater
+         *                                  than the first line indent)
+         * @param  current_column           column at which output starts
+         */
+        WrappingStreamBuf(std::streambuf * dest,
+                unsigned line_width=78,
+                unsigned first_line_indent=0,
+                unsigned subsequent_line_indent=0,
+                unsigned current_column=1)
+            : dest_(dest)
+            , dest_string_(nullptr)
+            , line_width_(line_width)
+            , indent_(subsequent_line_indent, ' ')
+            , line_(first_line_indent, ' ')
+            , line_cols_(first_line_indent)
+            , col_count_(first_line_indent + current_column)
+            , line_count_(1)
+            , last_space_(first_line_indent > 0 ? first_line_indent - 1 : std::string::npos)
+            , last_space_cols_(first_line_indent)
+            , pending_size_(0)
+            , pending_needed_(0) {
+        }
+
+        /**
+         * As above, but appending wrapped text to a string.
+         */
+        WrappingStreamBuf(std::string * dest,
+                unsigned line_width=78,
+                unsigned first_line_indent=0,
+                unsigned subsequent_line_indent=0,
+                unsigned current_column=1)
+            : WrappingStreamBuf(static_cast<std::streambuf *>(nullptr),
+                    line_width, first_line_indent, subsequent_line_indent, current_column) {
+            this->dest_string_ = dest;
+        }
+
+        /**
+         * Writes out the current partial line (without a line break).
+         */
+        void finish() {
+            this->put_pending_();
+            this->end_line_();
+        }
+
+    protected:
+        int_type overflow(int_type c) override {
+            if (!traits_type::eq_int_type(c, traits_type::eof())) {
+                this->put_(traits_type::to_char_type(c));
+            }
+            return traits_type::not_eof(c);
+        }
+
+        std::streamsize xsputn(const char * s, std::streamsize n) override {
+            std::streamsize i = 0;
+            while (i < n) {
+                // fast path: a run of ASCII characters that fit on the
+                // current line
+                std::streamsize start = i;
+                while (i < n
+                        && this->pending_needed_ == 0
+                        && this->col_count_ <= this->line_width_
+                        && !(this->col_count_ == 1 && this->line_count_ > 1)
+                        && static_cast<unsigned char>(s[i]) < 0x80
+                        && s[i] != '\n') {
+                    if (s[i] == ' ') {
+                        this->last_space_ = this->line_.size() + static_cast<std::size_t>(i - start);
+                        this->last_space_cols_ = this->line_cols_ + static_cast<unsigned>(i - start) + 1;
+                    }
+                    ++i;
+                    ++this->col_count_;
+                }
+                if (i > start) {
+                    this->line_.append(s + start, static_cast<std::size_t>(i - start));
+                    this->line_cols_ += static_cast<unsigned>(i - start);
+                    continue;
+                }
+                this->put_(s[i]);
+                ++i;
+            }
+            return n;
+        }
+
+    private:
+        /**
+         * Collects the bytes of each UTF-8 sequence, passing complete
+         * characters on to put_char_().
+         */
+        void put_(char c) {
+            unsigned char b = static_cast<unsigned char>(c);
+            if (this->pending_needed_ > 0) {
+                if ((b & 0xC0) == 0x80) {
+                    this->pending_[this->pending_size_++] = c;
+                    if (this->pending_size_ == this->pending_needed_) {
+                        this->put_char_(this->pending_, this->pending_size_, display_width(this->decode_pending_()));
+                        this->pending_size_ = 0;
+                        this->pending_needed_ = 0;
+                    }
+                    return;
+                }
+                // truncated sequence
+                this->put_pending_();
+            }
+            if (b < 0x80) {
+                this->put_char_(&c, 1, 1);
+            } else if (b >= 0xC2 && b <= 0xF4) {
+                this->pending_[0] = c;
+                this->pending_size_ = 1;
+                this->pending_needed_ = b < 0xE0 ? 2 : b < 0xF0 ? 3 : 4;
+            } else {
+                this->put_char_(&c, 1, 1);
+            }
+        }
+
+        void put_pending_() {
+            unsigned size = this->pending_size_;
+            this->pending_size_ = 0;
+            this->pending_needed_ = 0;
+            if (size > 0) {
+                this->put_char_(this->pending_, size, 1);
+            }
+        }
+
+        char32_t decode_pending_() const {
+            const unsigned char * p = reinterpret_cast<const unsigned char *>(this->pending_);
+            char32_t cp = p[0] & (0x7F >> this->pending_size_);
+            for (unsigned i = 1; i < this->pending_size_; ++i) {
+                cp = (cp << 6) | (p[i] & 0x3F);
+            }
+            return cp;
+        }
+
+        void put_char_(const char * s, unsigned size, unsigned width) {
+            if (size == 1 && *s == '\n') {
+                this->line_ += '\n';
+                this->end_line_();
+                this->col_count_ = 1;
+                this->line_count_ += 1;
+                return;
+            }
+            if (width > 0 && this->col_count_ + width - 1 > this->line_width_) {
+                if (this->last_space_ == std::string::npos) {
+                    this->line_ += '\n';
+                    this->end_line_();
+                    this->col_count_ = 1;
+                } else {
+                    // break at the last space, carrying the rest of the
+                    // line over
+                    this->emit_(this->line_.data(), this->last_space_);
+                    this->emit_("\n", 1);
+                    unsigned rest_cols = this->line_cols_ - this->last_space_cols_;
+                    this->line_.replace(0, this->last_space_ + 1, this->indent_);
+                    this->line_cols_ = static_cast<unsigned>(this->indent_.size()) + rest_cols;
+                    this->col_count_ = this->line_cols_ + 1;
+                    this->mark_indent_();
+                }
+            }
+            if (this->col_count_ == 1 && this->line_count_ > 1) {
+                this->line_ += this->indent_;
+                this->line_cols_ += static_cast<unsigned>(this->indent_.size());
+                this->col_count_ += static_cast<unsigned>(this->indent_.size());
+                if (!this->indent_.empty()) {
+                    this->last_space_ = this->line_.size() - 1;
+                    this->last_space_cols_ = this->line_cols_;
+                }
+            }
+            this->line_.append(s, size);
+            this->line_cols_ += width;
+            this->col_count_ += width;
+            if (size == 1 && *s == ' ') {
+                this->last_space_ = this->line_.size() - 1;
+                this->last_space_cols_ = this->line_cols_;
+            }
+        }
+
+        void end_line_() {
+            this->emit_(this->line_.data(), this->line_.size());
+            this->line_.clear();
+            this->line_cols_ = 0;
+            this->last_space_ = std::string::npos;
+        }
+
+        /**
+         * Sets the break candidate after the line has been replaced by the
+         * indent and the carried-over text (which has no spaces).
+         */
+        void mark_indent_() {
+            this->last_space_ = this->indent_.empty() ? std::string::npos : this->indent_.size() - 1;
+            this->last_space_cols_ = static_cast<unsigned>(this->indent_.size());
+        }
+
+        void emit_(const char * s, std::size_t n) {
+            if (n == 0) {
+                return;
+            }
+            if (this->dest_string_ != nullptr) {
+                this->dest_string_->append(s, n);
+            } else {
+                this->dest_->sputn(s, static_cast<std::streamsize>(n));
+            }
+        }
+
+    private:
+        std::streambuf *    dest_;
+        std::string *       dest_string_;
+        unsigned            line_width_;
+        std::string         indent_;
+        std::string         line_;
+        unsigned            line_cols_;
+        unsigned            col_count_;
+        unsigned            line_count_;
+        std::size_t         last_space_;
+        unsigned            last_space_cols_;
+        char                pending_[4];
+        unsigned            pending_size_;
+        unsigned            pending_needed_;
+
+}; // WrappingStreamBuf
+
+/**
+ * Wraps a line of text to specified width. Columns are counted as for
+ * WrappingStreamBuf.
  *
  * @param  source                   text to be wrapped
  * @param  line_width               width of wrapping
  * @param  first_line_indent        amount to indent first line
  * @param  subsequent_line_indent   amount to indent remaining lines
+ * @param  current_column           column at which output starts
  * @return                          wrapped text (line breaks="\n")
  */
 inline std::string textwrap(const std::string & source,
@@ -102,38 +502,236 @@ inline std::string textwrap(const std::string & source,
         unsigned first_line_indent=0,
         unsigned subsequent_line_indent=0,
         unsigned current_column=1) {
-    std::string wrapped(first_line_indent, ' ');
-    unsigned col_count = wrapped.size() + current_column;
-    unsigned line_count = 1;
-    std::string subsequent_line_indent_str(subsequent_line_indent, ' ');
-    for (std::string::const_iterator s = source.begin();
-            s != source.end();
-            ++s, ++col_count) {
-        if (*s == '\n') {
-            wrapped += "\n";
-            col_count = 0;
-            line_count += 1;
-            continue;
+    std::string wrapped;
+    std::size_t num_lines = source.size() / (line_width > 1 ? line_width / 2 : 1) + 1;
+    wrapped.reserve(source.size() + first_line_indent + num_lines * (subsequent_line_indent + 1));
+    WrappingStreamBuf wrapping_buf(&wrapped, line_width, first_line_indent, subsequent_line_indent, current_column);
+    wrapping_buf.sputn(source.data(), static_cast<std::streamsize>(source.size()));
+    wrapping_buf.finish();
+    return wrapped;
+}
+
+/**
+ * Lazy sequence of the tokens of a string, as delimited by a separator
+ * string or (see tokenize_on_any()) by any one of a set of separator
+ * characters. Tokens are std::string_view slices of the source, found one
+ * at a time as the sequence is iterated, so nothing is allocated per
+ * token; the source must outlive the tokenizer and its tokens.
+ * Separators are located 64 characters at a time with vector
+ * instructions where available (see charscan.hpp).
+ *
+ *      for (std::string_view field : textutil::tokenize(line, "\t")) {
+ *          ...
+ *      }
+ */
+class Tokenizer {
+
+    public:
+        class iterator {
+
+            public:
+                typedef std::forward_iterator_tag   iterator_category;
+                typedef std::string_view            value_type;
+                typedef std::ptrdiff_t              difference_type;
+                typedef const std::string_view *    pointer;
+                typedef const std::string_view &    reference;
+
+                iterator()
+                    : tokenizer_(nullptr)
+                    , pos_(0)
+                    , num_splits_(0)
+                    , block_pos_(std::string_view::npos)
+                    , block_mask_(0)
+                    , last_(true)
+                    , at_end_(true) {
+                }
+
+                explicit iterator(const Tokenizer * tokenizer)
+                    : tokenizer_(tokenizer)
+                    , pos_(0)
+                    , num_splits_(0)
+                    , block_pos_(std::string_view::npos)
+                    , block_mask_(0)
+                    , last_(false)
+                    , at_end_(false) {
+                    this->advance_();
+                }
+
+                reference operator*() const {
+                    return this->token_;
+                }
+
+                pointer operator->() const {
+                    return &this->token_;
+                }
+
+                iterator & operator++() {
+                    this->advance_();
+                    return *this;
+                }
+
+                iterator operator++(int) {
+                    iterator previous = *this;
+                    this->advance_();
+                    return previous;
+                }
+
+                bool operator==(const iterator & other) const {
+                    if (this->at_end_ || other.at_end_) {
+                        return this->at_end_ == other.at_end_;
+                    }
+                    return this->pos_ == other.pos_ && this->last_ == other.last_;
+                }
+
+                bool operator!=(const iterator & other) const {
+                    return !(*this == other);
+                }
+
+            private:
+                void advance_() {
+                    const Tokenizer & t = *this->tokenizer_;
+                    while (!this->last_) {
+                        std::size_t end_pos = std::string_view::npos;
+                        if (t.max_splits_ == 0 || this->num_splits_ < t.max_splits_) {
+                            end_pos = t.find_(this->pos_, this->block_pos_, this->block_mask_);
+                        }
+                        if (end_pos == std::string_view::npos) {
+                            this->token_ = t.source_.substr(this->pos_);
+                            this->last_ = true;
+                        } else {
+                            this->token_ = t.source_.substr(this->pos_, end_pos - this->pos_);
+                            this->pos_ = end_pos + t.separator_size_();
+                        }
+                        if (t.trim_tokens_) {
+                            this->token_ = trim_view(this->token_);
+                        }
+                        if (!this->token_.empty() || t.include_empty_tokens_) {
+                            if (!this->last_) {
+                                this->num_splits_ += 1;
+                            }
+                            return;
+                        }
+                    }
+                    this->at_end_ = true;
+                }
+
+            private:
+                const Tokenizer *   tokenizer_;
+                std::string_view    token_;
+                std::size_t         pos_;
+                unsigned            num_splits_;
+                std::size_t         block_pos_;
+                std::uint64_t       block_mask_;
+                bool                last_;
+                bool                at_end_;
+
+        }; // iterator
+
+    public:
+        /**
+         * @param source                 string to be split
+         * @param separator              separator token, or set of separator
+         *                               characters if <code>on_any</code>
+         * @param on_any                 split on any character of
+         *                               <code>separator</code>?
+         * @param max_splits             maximum number of splits (0 = no limit)
+         * @param trim_tokens            strip leading and trailing whitespace from each token
+         * @param include_empty_tokens   treat consecutive delimiters as valid (separating empty fields)?
+         */
+        Tokenizer(std::string_view source,
+                std::string_view separator,
+                bool on_any,
+                unsigned max_splits=0,
+                bool trim_tokens=true,
+                bool include_empty_tokens=true)
+            : source_(source)
+            , separator_(separator)
+            , on_any_(on_any)
+            , max_splits_(max_splits)
+            , trim_tokens_(trim_tokens)
+            , include_empty_tokens_(include_empty_tokens)
+            , scan_set_(on_any ? separator : separator.substr(0, 1))
+            , scan_kernel_(char_mask_kernel(scan_set_)) {
         }
-        if (col_count > line_width) {
-            std::string::size_type last_break = wrapped.find_last_of("\n");
-            std::string::size_type wrap_pos = wrapped.find_last_of(" ");
-            if (wrap_pos == std::string::npos || ((last_break != std::string::npos) && (last_break > wrap_pos))) {
-                wrapped += "\n";
-                col_count = 1;
-            } else {
-                wrapped.replace(wrap_pos, 1, "\n" + subsequent_line_indent_str);
-                col_count = wrapped.size() - wrap_pos;
+
+        iterator begin() const {
+            return iterator(this);
+        }
+
+        iterator end() const {
+            return iterator();
+        }
+
+    private:
+        /**
+         * Finds the next separator at or after <code>pos</code>. The
+         * separator mask of the 64-character block last scanned is cached
+         * by the caller, so each block is only scanned once however many
+         * tokens it holds.
+         */
+        std::size_t find_(std::size_t pos, std::size_t & block_pos, std::uint64_t & block_mask) const {
+            while (pos < this->source_.size()) {
+                if (pos < block_pos || pos - block_pos >= 64) {
+                    block_pos = pos;
+                    block_mask = char_mask(this->source_, pos, this->scan_set_, this->scan_kernel_);
+                }
+                std::uint64_t mask = block_mask >> (pos - block_pos);
+                if (mask == 0) {
+                    pos = block_pos + 64;
+                    continue;
+                }
+                std::size_t found = pos + static_cast<std::size_t>(__builtin_ctzll(mask));
+                if (this->on_any_ || this->source_.compare(found, this->separator_.size(), this->separator_) == 0) {
+                    return found;
+                }
+                // first character of a multi-character separator only
+                pos = found + 1;
             }
+            return std::string_view::npos;
         }
-        if (col_count == 1 && line_count > 1) {
-            wrapped += subsequent_line_indent_str;
-            col_count += subsequent_line_indent;
+
+        std::size_t separator_size_() const {
+            return this->on_any_ ? 1 : this->separator_.size();
         }
-        wrapped += *s;
 
-    }
-    return wrapped;
+    private:
+        std::string_view    source_;
+        std::string_view    separator_;
+        bool                on_any_;
+        unsigned            max_splits_;
+        bool                trim_tokens_;
+        bool                include_empty_tokens_;
+        CharSet             scan_set_;
+        CharMaskKernel      scan_kernel_;
+
+}; // Tokenizer
+
+/**
+ * Returns the tokens of <code>src</code>, as delimited by
+ * <code>sep</code>, as a lazy sequence of string views into
+ * <code>src</code>. Parameters are as for split().
+ */
+inline Tokenizer tokenize(
+        std::string_view src,
+        std::string_view sep = " ",
+        unsigned max_splits=0,
+        bool trim_tokens=true,
+        bool include_empty_tokens=true) {
+    return Tokenizer(src, sep, false, max_splits, trim_tokens, include_empty_tokens);
+}
+
+/**
+ * Returns the tokens of <code>src</code>, as delimited by any character in
+ * <code>sep</code>, as a lazy sequence of string views into
+ * <code>src</code>. Parameters are as for split_on_any().
+ */
+inline Tokenizer tokenize_on_any(
+        std::string_view src,
+        std::string_view sep,
+        unsigned max_splits=0,
+        bool trim_tokens=true,
+        bool include_empty_tokens=true) {
+    return Tokenizer(src, sep, true, max_splits, trim_tokens, include_empty_tokens);
 }
 
 /**
@@ -154,24 +752,8 @@ inline std::vector<std::string> split(
         bool trim_tokens=true,
         bool include_empty_tokens=true) {
     std::vector< std::string > v;
-    std::string::size_type start_pos = 0;
-    std::string::size_type end_pos = src.find(sep, start_pos);
-    unsigned num_splits = 0;
-    while (end_pos != std::string::npos && (max_splits == 0 || num_splits < max_splits)) {
-        std::string result = src.substr(start_pos, end_pos-start_pos);
-        if (trim_tokens) {
-            result = trim(result, " \t\n\r");
-        }
-        if (result.size() != 0 || include_empty_tokens) {
-            num_splits += 1;
-            v.push_back(result);
-        }
-        start_pos = end_pos+1;
-        end_pos = src.find(sep, start_pos);
-    }
-    std::string result = src.substr(start_pos, std::string::npos);
-    if (result.size() != 0 || include_empty_tokens) {
-        v.push_back(result);
+    for (std::string_view token : tokenize(src, sep, max_splits, trim_tokens, include_empty_tokens)) {
+        v.emplace_back(token);
     }
     return v;
 }
@@ -194,28 +776,86 @@ inline std::vector<std::string> split_on_any(
         bool trim_tokens=true,
         bool include_empty_tokens=true) {
     std::vector< std::string > v;
-    std::string::size_type start_pos = 0;
-    std::string::size_type end_pos = src.find_first_of(sep, start_pos);
-    unsigned num_splits = 0;
-    while (end_pos != std::string::npos && (max_splits == 0 || num_splits < max_splits)) {
-        std::string result = src.substr(start_pos, end_pos-start_pos);
-        if (trim_tokens) {
-            result = trim(result, " \t\n\r");
-        }
-        if (result.size() != 0 || include_empty_tokens) {
-            num_splits += 1;
-            v.push_back(result);
-        }
-        start_pos = end_pos+1;
-        end_pos = src.find_first_of(sep, start_pos);
-    }
-    std::string result = src.substr(start_pos, std::string::npos);
-    if (result.size() != 0 || include_empty_tokens) {
-        v.push_back(result);
+    for (std::string_view token : tokenize_on_any(src, sep, max_splits, trim_tokens, include_empty_tokens)) {
+        v.emplace_back(token);
     }
     return v;
 }
 
+/**
+ * Splits a string into tokens as delimited by <code>sep</code>, replacing
+ * the contents of a caller-owned vector with views into <code>src</code>.
+ * Reusing the vector across calls avoids allocating once it has grown to
+ * the largest number of tokens. Other parameters are as for split().
+ *
+ * @param tokens                 destination for tokens
+ * @param src                    source string to be split
+ */
+inline void split_views(
+        std::vector<std::string_view> & tokens,
+        std::string_view src,
+        std::string_view sep = " ",
+        unsigned max_splits=0,
+        bool trim_tokens=true,
+        bool include_empty_tokens=true) {
+    tokens.clear();
+    for (std::string_view token : tokenize(src, sep, max_splits, trim_tokens, include_empty_tokens)) {
+        tokens.push_back(token);
+    }
+}
+
+/**
+ * Splits a string into tokens as delimited by <code>sep</code>, returning
+ * views into <code>src</code>. Parameters are as for split().
+ */
+inline std::vector<std::string_view> split_views(
+        std::string_view src,
+        std::string_view sep = " ",
+        unsigned max_splits=0,
+        bool trim_tokens=true,
+        bool include_empty_tokens=true) {
+    std::vector<std::string_view> tokens;
+    split_views(tokens, src, sep, max_splits, trim_tokens, include_empty_tokens);
+    return tokens;
+}
+
+/**
+ * Splits a string into tokens as delimited by any character in
+ * <code>sep</code>, replacing the contents of a caller-owned vector with
+ * views into <code>src</code>. Other parameters are as for split_on_any().
+ *
+ * @param tokens                 destination for tokens
+ * @param src                    source string to be split
+ */
+inline void split_views_on_any(
+        std::vector<std::string_view> & tokens,
+        std::string_view src,
+        std::string_view sep,
+        unsigned max_splits=0,
+        bool trim_tokens=true,
+        bool include_empty_tokens=true) {
+    tokens.clear();
+    for (std::string_view token : tokenize_on_any(src, sep, max_splits, trim_tokens, include_empty_tokens)) {
+        tokens.push_back(token);
+    }
+}
+
+/**
+ * Splits a string into tokens as delimited by any character in
+ * <code>sep</code>, returning views into <code>src</code>. Parameters are
+ * as for split_on_any().
+ */
+inline std::vector<std::string_view> split_views_on_any(
+        std::string_view src,
+        std::string_view sep,
+        unsigned max_splits=0,
+        bool trim_tokens=true,
+        bool include_empty_tokens=true) {
+    std::vector<std::string_view> tokens;
+    split_views_on_any(tokens, src, sep, max_splits, trim_tokens, include_empty_tokens);
+    return tokens;
+}
+
 /////////////////////////////////////////////////////////////////////////
 // utility to join elements to string
 
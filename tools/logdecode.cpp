@@ -0,0 +1,58 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright 2013 Jeet Sukumaran.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program. If not, see <http://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+// Renders binary logs written by colugo::Logger binary channels as text.
+//
+// Build:
+//
+//      c++ -std=c++17 -O2 -pthread -Iinclude -o colugo-logdecode tools/logdecode.cpp
+
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <colugo/cmdopt.hpp>
+#include <colugo/console.hpp>
+#include <colugo/logdecode.hpp>
+
+int main(int argc, const char * argv[]) {
+    colugo::OptionParser parser("colugo-logdecode 1.0",
+            "Renders binary log files as text, in the same layout used by text log channels. "
+            "Reads standard input if no files are given.",
+            "%prog [options] [LOGFILE [LOGFILE ...]]");
+    parser.parse(argc, argv);
+    std::vector<std::string> args = parser.get_args();
+    try {
+        if (args.empty()) {
+            colugo::logbinary::Decoder decoder;
+            decoder.decode(std::cin, std::cout);
+        }
+        for (auto & path : args) {
+            std::ifstream in(path, std::ios::binary);
+            if (!in) {
+                colugo::console::abort("Failed to open file: ", path);
+            }
+            colugo::logbinary::Decoder decoder;
+            decoder.decode(in, std::cout);
+        }
+    } catch (colugo::logbinary::DecodeError & e) {
+        colugo::console::abort("Failed to decode log: ", e.what());
+    }
+    return 0;
+}